@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""
+Benchmark driver for matmul_seq, matmul, sor and laplace.
+
+Runs every program over the given problem sizes, rank counts and thread
+counts, with warm-up runs and repetitions, and reports the median, p95
+and min time of each case. The time is the one the program prints
+itself ("Time:" or "Execution time"), that of the solver or kernel
+without the set up; a run that prints none counts as failed.
+
+Derived rates:
+  matmul, matmul_seq  GFLOP/s       2 N^3 / time
+  sor, laplace        MLUP/s        lattice updates per second, half a
+                                    grid of N x N per half sweep
+                      GB/s          each half sweep reads and writes the
+                                    whole grid once, 16 bytes per point
+                                    Only for the SOR solvers (-s sor or
+                                    mixed); the iterations of cg and mg
+                                    are not half sweeps.
+
+Results go to a table on stdout and, with --csv / --json, to files that
+can be compared between builds; --label names the build in them.
+
+Example:
+  ./bench.py --programs matmul,laplace --sizes 1024,2048 --ranks 1,4 \\
+      --reps 5 --label O3-native --csv bench.csv --json bench.json
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+PROGRAMS = ["matmul_seq", "matmul", "sor", "laplace"]
+
+TIME_RE = re.compile(r"^(?:Time|Execution time on\s+\d+ nodes):\s*([0-9.eE+-]+)",
+                     re.M)
+ITER_RE = re.compile(r"^Number of iterations = (\d+)", re.M)
+
+
+def int_list(text):
+    return [int(x) for x in text.split(",") if x]
+
+
+def command(args, program, size, ranks, threads):
+    """Command line of one run, None when the case does not apply."""
+    binary = os.path.join(args.bin_dir, program)
+    mpirun = args.mpirun.split() + ["-np", str(ranks)] + args.mpirun_args.split()
+    if program == "matmul_seq":
+        # fixed size, SIZE in matmul_seq.c
+        if size != 1024 or ranks != 1 or threads != 1:
+            return None
+        return mpirun + [binary]
+    if program == "matmul":
+        if threads != 1:
+            return None
+        return mpirun + [binary, str(size)]
+    if program == "sor":
+        if ranks != 1:
+            return None
+        return [binary, "-n", str(size), "-P", "0", "-t", str(threads)] \
+            + args.sor_args.split()
+    if program == "laplace":
+        return mpirun + [binary, "-n", str(size), "-P", "0", "-t", str(threads)] \
+            + args.laplace_args.split()
+    return None
+
+
+def run(cmd, threads, timeout):
+    """Run once, return (time, iterations, error)."""
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    try:
+        proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              env=env, timeout=timeout, universal_newlines=True)
+    except subprocess.TimeoutExpired:
+        return None, None, "timeout"
+    except OSError as e:
+        return None, None, str(e)
+    if proc.returncode != 0:
+        return None, None, "exit status %d" % proc.returncode
+    match = TIME_RE.search(proc.stdout)
+    if not match:
+        return None, None, "no time in the output"
+    seconds = float(match.group(1))
+    match = ITER_RE.search(proc.stdout)
+    iterations = int(match.group(1)) if match else None
+    return seconds, iterations, None
+
+
+def percentile(values, p):
+    """Nearest rank percentile of the sorted values."""
+    return values[max(0, math.ceil(p / 100.0 * len(values)) - 1)]
+
+
+def solver(args, program):
+    """Solver selected with -s in the extra arguments of sor or laplace."""
+    words = (args.sor_args if program == "sor" else args.laplace_args).split()
+    for i, word in enumerate(words[:-1]):
+        if word == "-s":
+            return words[i + 1]
+    return "sor"
+
+
+def rates(program, size, seconds, iterations, method):
+    if seconds <= 0:
+        return {}
+    if program in ("matmul", "matmul_seq"):
+        return {"gflops": 2.0 * size ** 3 / seconds / 1e9}
+    if iterations is None or method not in ("sor", "mixed"):
+        return {}
+    points = float(size) * size * iterations
+    return {"mlups": points / 2 / seconds / 1e6,
+            "gbs": points * 16 / seconds / 1e9}
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"],
+                                       cwd=os.path.dirname(os.path.abspath(__file__)),
+                                       stderr=subprocess.DEVNULL,
+                                       universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--programs", default=",".join(PROGRAMS),
+                        help="comma separated, from %s" % ",".join(PROGRAMS))
+    parser.add_argument("--sizes", type=int_list, default=[512, 1024])
+    parser.add_argument("--ranks", type=int_list, default=[1, 4])
+    parser.add_argument("--threads", type=int_list, default=[1])
+    parser.add_argument("--warmup", type=int, default=1)
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--timeout", type=float, default=3600,
+                        help="seconds per run")
+    parser.add_argument("--bin-dir", default=".")
+    parser.add_argument("--mpirun", default="mpirun")
+    parser.add_argument("--mpirun-args", default="",
+                        help="e.g. --mpirun-args=\"--bind-to core\"")
+    parser.add_argument("--sor-args", default="", help="e.g. \"-w auto -c linf\"")
+    parser.add_argument("--laplace-args", default="")
+    parser.add_argument("--label", default="", help="name of the build")
+    parser.add_argument("--csv")
+    parser.add_argument("--json")
+    args = parser.parse_args()
+
+    programs = [p for p in args.programs.split(",") if p]
+    for program in programs:
+        if program not in PROGRAMS:
+            parser.error("unknown program %s" % program)
+
+    results = []
+    print("%-10s %6s %5s %7s %5s %10s %10s %10s %9s %9s %9s" %
+          ("program", "size", "ranks", "threads", "runs", "median", "p95", "min",
+           "GFLOP/s", "MLUP/s", "GB/s"))
+    for program in programs:
+        for size in args.sizes:
+            for ranks in args.ranks:
+                for threads in args.threads:
+                    cmd = command(args, program, size, ranks, threads)
+                    if cmd is None:
+                        continue
+                    for _ in range(args.warmup):
+                        run(cmd, threads, args.timeout)
+                    times, iterations, error = [], None, None
+                    for _ in range(args.reps):
+                        seconds, its, error = run(cmd, threads, args.timeout)
+                        if error:
+                            break
+                        times.append(seconds)
+                        iterations = its
+                    result = {"program": program, "size": size, "ranks": ranks,
+                              "threads": threads, "command": " ".join(cmd),
+                              "runs": len(times), "iterations": iterations,
+                              "times": times, "error": error or ""}
+                    if times and not error:
+                        times.sort()
+                        result["median"] = statistics.median(times)
+                        result["p95"] = percentile(times, 95)
+                        result["min"] = times[0]
+                        result["mean"] = statistics.mean(times)
+                        result.update(rates(program, size, result["median"],
+                                            iterations, solver(args, program)))
+                        print("%-10s %6d %5d %7d %5d %10.4f %10.4f %10.4f %9s %9s %9s" %
+                              (program, size, ranks, threads, len(times),
+                               result["median"], result["p95"], result["min"],
+                               "%.2f" % result["gflops"] if "gflops" in result else "-",
+                               "%.1f" % result["mlups"] if "mlups" in result else "-",
+                               "%.2f" % result["gbs"] if "gbs" in result else "-"))
+                    else:
+                        print("%-10s %6d %5d %7d  failed: %s" %
+                              (program, size, ranks, threads, error))
+                    sys.stdout.flush()
+                    results.append(result)
+
+    meta = {"label": args.label, "revision": git_revision(),
+            "host": platform.node(), "machine": platform.machine(),
+            "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+            "warmup": args.warmup, "reps": args.reps}
+    if args.csv:
+        fields = ["label", "revision", "date", "program", "size", "ranks", "threads",
+                  "runs", "iterations", "median", "p95", "min", "mean",
+                  "gflops", "mlups", "gbs", "error", "command"]
+        new = not os.path.exists(args.csv)
+        with open(args.csv, "a", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=fields, extrasaction="ignore")
+            if new:
+                writer.writeheader()
+            for result in results:
+                row = dict(result, label=meta["label"], revision=meta["revision"],
+                           date=meta["date"])
+                writer.writerow(row)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"meta": meta, "results": results}, f, indent=2)
+            f.write("\n")
+    return 1 if any(r["error"] for r in results) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
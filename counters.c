@@ -0,0 +1,346 @@
+// Hardware performance counters with perf_event_open.
+//
+// Every thread of the team gets its own counters, opened from inside a
+// parallel region so each one counts the thread that opened it. They
+// are switched on and off together from the calling thread. Counters the
+// kernel refuses (no PMU in a virtual machine, perf_event_paranoid) are
+// skipped one by one, so the report has whatever is left; without Linux
+// only the time is reported.
+//
+// Floating point operations are counted with the FP_ARITH_INST_RETIRED
+// events on Intel, with umasks of equal width merged, and with
+// RETIRED_SSE_AVX_FLOPS on AMD. Memory traffic is estimated as one 64
+// byte line per last level cache miss, which leaves out the write backs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "counters.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define COUNTERS_PERF 1
+#else
+#define COUNTERS_PERF 0
+#endif
+
+#define CACHE_LINE 64
+
+enum
+{
+	EVENT_TASK_CLOCK,
+	EVENT_CYCLES,
+	EVENT_INSTRUCTIONS,
+	EVENT_LLC_REFERENCES,
+	EVENT_LLC_MISSES,
+	EVENT_FLOPS_1,		// Operations counted with weight 1, 2, 4, 8 and 16.
+	EVENT_FLOPS_2,
+	EVENT_FLOPS_4,
+	EVENT_FLOPS_8,
+	EVENT_FLOPS_16
+};
+
+static const double flopWeight[COUNTER_EVENTS] = { 0, 0, 0, 0, 0, 1, 2, 4, 8, 16 };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#if COUNTERS_PERF
+
+// perf type and config of every event, type -1 where this CPU has none.
+static void event_config(int event, int *type, unsigned long long *config)
+{
+	// FP_ARITH_INST_RETIRED umasks: scalar double|single, 128 bit double,
+	// 128 bit single|256 bit double, 256 bit single|512 bit double, 512 bit single.
+	static const unsigned intelUmask[5] = { 0x03, 0x04, 0x18, 0x60, 0x80 };
+	int intel = 0, amd = 0;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	intel = __builtin_cpu_is("intel");
+	amd = __builtin_cpu_is("amd");
+#endif
+
+	*type = PERF_TYPE_HARDWARE;
+	switch (event)
+	{
+	case EVENT_TASK_CLOCK:
+		*type = PERF_TYPE_SOFTWARE;
+		*config = PERF_COUNT_SW_TASK_CLOCK;
+		return;
+	case EVENT_CYCLES:
+		*config = PERF_COUNT_HW_CPU_CYCLES;
+		return;
+	case EVENT_INSTRUCTIONS:
+		*config = PERF_COUNT_HW_INSTRUCTIONS;
+		return;
+	case EVENT_LLC_REFERENCES:
+		*config = PERF_COUNT_HW_CACHE_REFERENCES;
+		return;
+	case EVENT_LLC_MISSES:
+		*config = PERF_COUNT_HW_CACHE_MISSES;
+		return;
+	}
+
+	*type = PERF_TYPE_RAW;
+	if (intel)
+	{
+		*config = (intelUmask[event - EVENT_FLOPS_1] << 8) | 0xc7;
+	}
+	else if (amd && event == EVENT_FLOPS_1)
+	{
+		*config = 0xff03;
+	}
+	else
+	{
+		*type = -1;
+	}
+}
+
+static int open_event(int event)
+{
+	struct perf_event_attr attr;
+	int type;
+	unsigned long long config;
+
+	event_config(event, &type, &config);
+	if (type < 0)
+	{
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	// More events than counters are multiplexed, the counts are scaled up.
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#endif
+
+int counters_open(struct counter_region *region, const char *name)
+{
+	const char *env = getenv("KERNEL_COUNTERS");
+	int threads = 1;
+
+	memset(region, 0, sizeof(*region));
+	region->name = name;
+	if (env == NULL || atoi(env) == 0)
+	{
+		return 0;
+	}
+
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	region->threads = threads;
+	region->fd = malloc(sizeof(int) * threads * COUNTER_EVENTS);
+
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(threads)
+#endif
+	{
+		int t = 0, e;
+
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		for (e = 0; e < COUNTER_EVENTS; e++)
+		{
+#if COUNTERS_PERF
+			region->fd[t * COUNTER_EVENTS + e] = open_event(e);
+#else
+			region->fd[t * COUNTER_EVENTS + e] = -1;
+#endif
+		}
+	}
+
+	return 1;
+}
+
+void counters_start(struct counter_region *region)
+{
+	int i;
+
+	if (region->threads == 0)
+	{
+		return;
+	}
+	for (i = 0; i < region->threads * COUNTER_EVENTS; i++)
+	{
+#if COUNTERS_PERF
+		if (region->fd[i] >= 0)
+		{
+			ioctl(region->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+	region->started = now();
+}
+
+void counters_stop(struct counter_region *region)
+{
+	int i;
+
+	if (region->threads == 0)
+	{
+		return;
+	}
+	region->seconds += now() - region->started;
+	for (i = 0; i < region->threads * COUNTER_EVENTS; i++)
+	{
+#if COUNTERS_PERF
+		if (region->fd[i] >= 0)
+		{
+			ioctl(region->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+#endif
+	}
+}
+
+// Total of event e over all threads, scaled for multiplexing; -1 when
+// no thread could count it.
+static double read_event(struct counter_region *region, int e)
+{
+	double sum = -1.0;
+	int t;
+
+	for (t = 0; t < region->threads; t++)
+	{
+#if COUNTERS_PERF
+		unsigned long long data[3];
+		int fd = region->fd[t * COUNTER_EVENTS + e];
+
+		if (fd >= 0 && read(fd, data, sizeof(data)) == sizeof(data))
+		{
+			if (sum < 0.0)
+			{
+				sum = 0.0;
+			}
+			if (data[2] > 0)
+			{
+				sum += (double)data[0] * data[1] / data[2];
+			}
+		}
+#endif
+	}
+
+	return sum;
+}
+
+void counters_report(struct counter_region *region, const char *label, double flops, double bytes)
+{
+	double v[COUNTER_EVENTS];
+	double seconds = region->seconds;
+	double countedFlops = -1.0;
+	int i;
+
+	if (region->threads == 0)
+	{
+		return;
+	}
+
+	for (i = 0; i < COUNTER_EVENTS; i++)
+	{
+		v[i] = read_event(region, i);
+		if (flopWeight[i] > 0 && v[i] >= 0.0)
+		{
+			countedFlops = ((countedFlops < 0.0) ? 0.0 : countedFlops) + flopWeight[i] * v[i];
+		}
+	}
+
+	printf("%sCounters %s: %.6f s", label, region->name, seconds);
+	if (v[EVENT_TASK_CLOCK] >= 0.0 && seconds > 0.0)
+	{
+		printf(", %.2f CPUs busy", v[EVENT_TASK_CLOCK] * 1e-9 / seconds);
+	}
+	if (v[EVENT_CYCLES] > 0.0 && v[EVENT_INSTRUCTIONS] >= 0.0)
+	{
+		printf(", %.3g cycles, IPC %.2f", v[EVENT_CYCLES], v[EVENT_INSTRUCTIONS] / v[EVENT_CYCLES]);
+	}
+	if (v[EVENT_LLC_MISSES] >= 0.0)
+	{
+		printf(", LLC misses %.3g", v[EVENT_LLC_MISSES]);
+		if (v[EVENT_LLC_REFERENCES] > 0.0)
+		{
+			printf(" (%.1f%% of references)", 100.0 * v[EVENT_LLC_MISSES] / v[EVENT_LLC_REFERENCES]);
+		}
+	}
+	printf("\n");
+
+	// Roofline: counted numbers where there are any, the model otherwise.
+	// A model of 0 means the caller has none.
+	printf("%s ", label);
+	if (countedFlops >= 0.0)
+	{
+		printf(" %.3g flops counted", countedFlops);
+		if (flops > 0.0)
+		{
+			printf(" (model %.3g)", flops);
+		}
+		flops = countedFlops;
+	}
+	else if (flops > 0.0)
+	{
+		printf(" %.3g flops by the model", flops);
+	}
+	else
+	{
+		printf(" flops not counted");
+	}
+	if (v[EVENT_LLC_MISSES] >= 0.0)
+	{
+		printf(", %.3g bytes from memory", v[EVENT_LLC_MISSES] * CACHE_LINE);
+		if (bytes > 0.0)
+		{
+			printf(" (model %.3g)", bytes);
+		}
+		bytes = v[EVENT_LLC_MISSES] * CACHE_LINE;
+	}
+	else if (bytes > 0.0)
+	{
+		printf(", %.3g bytes by the model", bytes);
+	}
+	printf("\n");
+	if (seconds > 0.0 && flops > 0.0)
+	{
+		printf("%s  %.3f GFLOP/s", label, flops / seconds * 1e-9);
+		if (bytes > 0.0)
+		{
+			printf(", %.3f GB/s, arithmetic intensity %.3f flops/byte", bytes / seconds * 1e-9, flops / bytes);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < region->threads * COUNTER_EVENTS; i++)
+	{
+#if COUNTERS_PERF
+		if (region->fd[i] >= 0)
+		{
+			close(region->fd[i]);
+		}
+#endif
+	}
+	free(region->fd);
+	region->fd = NULL;
+	region->threads = 0;
+}
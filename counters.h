@@ -0,0 +1,37 @@
+// Hardware performance counters around the compute kernels, used by
+// matmul_seq.c, matmul_mpi.c, sor_seq.c and laplace_mpi.c.
+//
+// Switched on by setting KERNEL_COUNTERS=1 in the environment. Counters
+// the kernel or the CPU do not provide are left out of the report.
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#define COUNTER_EVENTS 10
+
+struct counter_region
+{
+	const char *name;
+	int threads;		// Threads counted, 0 when switched off.
+	int *fd;			// threads x COUNTER_EVENTS, -1 where not available.
+	double seconds;		// Wall time of all passes.
+	double started;
+};
+
+// Open the counters of region name for every thread of the OpenMP team
+// (the calling thread without OpenMP). Call it outside parallel regions,
+// with the team the kernel will run on. Returns 0 when switched off.
+int counters_open(struct counter_region *region, const char *name);
+
+// Count one pass through the region, passes add up.
+void counters_start(struct counter_region *region);
+void counters_stop(struct counter_region *region);
+
+// Print the counts prefixed by label, with the rates and the arithmetic
+// intensity of a roofline plot, and close the counters. flops and bytes
+// are what the kernel needs by its model, they are used when the CPU
+// does not count floating point operations and to compare with the
+// memory traffic that was counted.
+void counters_report(struct counter_region *region, const char *label, double flops, double bytes);
+
+#endif
@@ -0,0 +1,482 @@
+// Cache blocked matrix multiplication.
+//
+// The loops follow the usual GotoBLAS/BLIS layout. c is split into
+// GEMM_NC wide column blocks (the packed slice of b stays in L3), the
+// inner dimension into GEMM_KC deep slices (one micro panel of b stays
+// in L1) and a into GEMM_MC row blocks (the packed block of a stays in
+// L2). The packed panels are then walked by a register blocked
+// mr x nr micro kernel.
+//
+// There is one micro kernel per instruction set (scalar, SSE2, AVX2+FMA
+// and AVX-512), and the widest one the CPU supports is picked the first
+// time gemm() is called. Setting GEMM_KERNEL in the environment to one
+// of the kernel names forces that kernel instead. Built with
+// GEMM_NO_SIMD only the scalar kernel is left.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gemm.h"
+
+#if !defined(GEMM_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86 1
+#include <immintrin.h>
+#else
+#define GEMM_X86 0
+#endif
+
+// Largest micro tile of all kernels, used to size the scratch buffers.
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 16
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 2048
+#define GEMM_ALIGN 64
+
+typedef void (*micro_kernel_fn)(int kc, const double *a, const double *b, double *c, int ldc);
+
+struct gemm_kernel
+{
+	const char *name;
+	int mr, nr;
+	micro_kernel_fn micro;
+	int (*supported)(void);
+};
+
+// Pack an (mc x kc) block of a into micro panels of mr rows, each
+// stored column by column. Rows past mc are padded with zeros.
+static void pack_a(int mr, int mc, int kc, const double *a, int lda, double *packed)
+{
+	int i, p, r;
+	for (i = 0; i < mc; i += mr)
+	{
+		int rows = (mc - i < mr) ? mc - i : mr;
+		for (p = 0; p < kc; p++)
+		{
+			for (r = 0; r < rows; r++)
+			{
+				packed[r] = a[(size_t)(i + r) * lda + p];
+			}
+			for (; r < mr; r++)
+			{
+				packed[r] = 0.0;
+			}
+			packed += mr;
+		}
+	}
+}
+
+// Pack a (kc x nc) block of b into micro panels of nr columns, each
+// stored row by row. Columns past nc are padded with zeros.
+static void pack_b(int nr, int kc, int nc, const double *b, int ldb, double *packed)
+{
+	int j, p, r;
+	for (j = 0; j < nc; j += nr)
+	{
+		int cols = (nc - j < nr) ? nc - j : nr;
+		for (p = 0; p < kc; p++)
+		{
+			const double *row = &b[(size_t)p * ldb + j];
+			for (r = 0; r < cols; r++)
+			{
+				packed[r] = row[r];
+			}
+			for (; r < nr; r++)
+			{
+				packed[r] = 0.0;
+			}
+			packed += nr;
+		}
+	}
+}
+
+// c (4 x 8) += a micro panel * b micro panel.
+// The accumulators are kept in registers for the whole kc loop.
+static void micro_kernel_scalar(int kc, const double *a, const double *b, double *c, int ldc)
+{
+	double acc[4][8] = { { 0.0 } };
+	int i, j, p;
+
+	for (p = 0; p < kc; p++)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			double ai = a[i];
+			for (j = 0; j < 8; j++)
+			{
+				acc[i][j] += ai * b[j];
+			}
+		}
+		a += 4;
+		b += 8;
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			c[i * ldc + j] += acc[i][j];
+		}
+	}
+}
+
+static int supported_always(void)
+{
+	return 1;
+}
+
+#if GEMM_X86
+
+// c (4 x 4) += a * b, two doubles per register.
+__attribute__((target("sse2")))
+static void micro_kernel_sse2(int kc, const double *a, const double *b, double *c, int ldc)
+{
+	__m128d acc[4][2];
+	int i, p;
+
+#pragma GCC unroll 4
+	for (i = 0; i < 4; i++)
+	{
+		acc[i][0] = _mm_setzero_pd();
+		acc[i][1] = _mm_setzero_pd();
+	}
+
+	for (p = 0; p < kc; p++)
+	{
+		__m128d b0 = _mm_loadu_pd(&b[0]);
+		__m128d b1 = _mm_loadu_pd(&b[2]);
+#pragma GCC unroll 4
+		for (i = 0; i < 4; i++)
+		{
+			__m128d ai = _mm_set1_pd(a[i]);
+			acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(ai, b0));
+			acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(ai, b1));
+		}
+		a += 4;
+		b += 4;
+	}
+
+#pragma GCC unroll 4
+	for (i = 0; i < 4; i++)
+	{
+		_mm_storeu_pd(&c[i * ldc + 0], _mm_add_pd(_mm_loadu_pd(&c[i * ldc + 0]), acc[i][0]));
+		_mm_storeu_pd(&c[i * ldc + 2], _mm_add_pd(_mm_loadu_pd(&c[i * ldc + 2]), acc[i][1]));
+	}
+}
+
+// c (6 x 8) += a * b, twelve accumulators of four doubles.
+__attribute__((target("avx2,fma")))
+static void micro_kernel_avx2(int kc, const double *a, const double *b, double *c, int ldc)
+{
+	__m256d acc[6][2];
+	int i, p;
+
+#pragma GCC unroll 6
+	for (i = 0; i < 6; i++)
+	{
+		acc[i][0] = _mm256_setzero_pd();
+		acc[i][1] = _mm256_setzero_pd();
+	}
+
+	for (p = 0; p < kc; p++)
+	{
+		__m256d b0 = _mm256_loadu_pd(&b[0]);
+		__m256d b1 = _mm256_loadu_pd(&b[4]);
+#pragma GCC unroll 6
+		for (i = 0; i < 6; i++)
+		{
+			__m256d ai = _mm256_broadcast_sd(&a[i]);
+			acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+			acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+		}
+		a += 6;
+		b += 8;
+	}
+
+#pragma GCC unroll 6
+	for (i = 0; i < 6; i++)
+	{
+		_mm256_storeu_pd(&c[i * ldc + 0], _mm256_add_pd(_mm256_loadu_pd(&c[i * ldc + 0]), acc[i][0]));
+		_mm256_storeu_pd(&c[i * ldc + 4], _mm256_add_pd(_mm256_loadu_pd(&c[i * ldc + 4]), acc[i][1]));
+	}
+}
+
+// c (8 x 16) += a * b, sixteen accumulators of eight doubles.
+__attribute__((target("avx512f")))
+static void micro_kernel_avx512(int kc, const double *a, const double *b, double *c, int ldc)
+{
+	__m512d acc[8][2];
+	int i, p;
+
+#pragma GCC unroll 8
+	for (i = 0; i < 8; i++)
+	{
+		acc[i][0] = _mm512_setzero_pd();
+		acc[i][1] = _mm512_setzero_pd();
+	}
+
+	for (p = 0; p < kc; p++)
+	{
+		__m512d b0 = _mm512_loadu_pd(&b[0]);
+		__m512d b1 = _mm512_loadu_pd(&b[8]);
+#pragma GCC unroll 8
+		for (i = 0; i < 8; i++)
+		{
+			__m512d ai = _mm512_set1_pd(a[i]);
+			acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+			acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+		}
+		a += 8;
+		b += 16;
+	}
+
+#pragma GCC unroll 8
+	for (i = 0; i < 8; i++)
+	{
+		_mm512_storeu_pd(&c[i * ldc + 0], _mm512_add_pd(_mm512_loadu_pd(&c[i * ldc + 0]), acc[i][0]));
+		_mm512_storeu_pd(&c[i * ldc + 8], _mm512_add_pd(_mm512_loadu_pd(&c[i * ldc + 8]), acc[i][1]));
+	}
+}
+
+static int supported_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int supported_avx2(void)
+{
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static int supported_avx512(void)
+{
+	return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+// All kernels, widest first. The scalar kernel is the reference and
+// has to stay last.
+static const struct gemm_kernel kernels[] =
+{
+#if GEMM_X86
+	{ "avx512", 8, 16, micro_kernel_avx512, supported_avx512 },
+	{ "avx2", 6, 8, micro_kernel_avx2, supported_avx2 },
+	{ "sse2", 4, 4, micro_kernel_sse2, supported_sse2 },
+#endif
+	{ "scalar", 4, 8, micro_kernel_scalar, supported_always },
+};
+
+#define NUM_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+static const struct gemm_kernel *selected;
+
+static const struct gemm_kernel *select_kernel(void)
+{
+	const char *forced = getenv("GEMM_KERNEL");
+	int i;
+
+	if (selected != NULL)
+	{
+		return selected;
+	}
+
+#if GEMM_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < NUM_KERNELS; i++)
+	{
+		if (!kernels[i].supported())
+		{
+			continue;
+		}
+		if (forced == NULL || strcmp(forced, kernels[i].name) == 0)
+		{
+			selected = &kernels[i];
+			return selected;
+		}
+	}
+
+	// Unknown or unsupported kernel asked for, fall back to scalar.
+	selected = &kernels[NUM_KERNELS - 1];
+	return selected;
+}
+
+static void gemm_with_kernel(const struct gemm_kernel *kern, int m, int n, int k,
+	const double *a, int lda, const double *b, int ldb, double *c, int ldc)
+{
+	double *aPacked, *bPacked;
+	double edge[GEMM_MAX_MR * GEMM_MAX_NR];
+	int MR = kern->mr;
+	int NR = kern->nr;
+	int jc, pc, ic, jr, ir, i, j;
+
+	if (m <= 0 || n <= 0 || k <= 0)
+	{
+		return;
+	}
+
+	if (posix_memalign((void **)&aPacked, GEMM_ALIGN, sizeof(double) * (GEMM_MC + GEMM_MAX_MR) * GEMM_KC) != 0 ||
+		posix_memalign((void **)&bPacked, GEMM_ALIGN, sizeof(double) * (GEMM_NC + GEMM_MAX_NR) * GEMM_KC) != 0)
+	{
+		abort();
+	}
+
+	for (jc = 0; jc < n; jc += GEMM_NC)
+	{
+		int nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+		for (pc = 0; pc < k; pc += GEMM_KC)
+		{
+			int kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+
+			pack_b(NR, kc, nc, &b[(size_t)pc * ldb + jc], ldb, bPacked);
+
+			for (ic = 0; ic < m; ic += GEMM_MC)
+			{
+				int mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+
+				pack_a(MR, mc, kc, &a[(size_t)ic * lda + pc], lda, aPacked);
+
+				for (jr = 0; jr < nc; jr += NR)
+				{
+					int nr = (nc - jr < NR) ? nc - jr : NR;
+
+					for (ir = 0; ir < mc; ir += MR)
+					{
+						int mr = (mc - ir < MR) ? mc - ir : MR;
+						double *cc = &c[(size_t)(ic + ir) * ldc + jc + jr];
+						const double *ap = &aPacked[ir * kc];
+						const double *bp = &bPacked[jr * kc];
+
+						if (mr == MR && nr == NR)
+						{
+							kern->micro(kc, ap, bp, cc, ldc);
+						}
+						else
+						{
+							// Partial tile at the edge of c, go through a scratch tile.
+							memset(edge, 0, sizeof(edge));
+							kern->micro(kc, ap, bp, edge, NR);
+							for (i = 0; i < mr; i++)
+							{
+								for (j = 0; j < nr; j++)
+								{
+									cc[i * ldc + j] += edge[i * NR + j];
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	free(aPacked);
+	free(bPacked);
+}
+
+void gemm(int m, int n, int k, const double *a, int lda,
+	const double *b, int ldb, double *c, int ldc)
+{
+	gemm_with_kernel(select_kernel(), m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+const char *gemm_kernel_name(void)
+{
+	return select_kernel()->name;
+}
+
+// Uniform pseudo random numbers in [-0.5, 0.5), from a generator of
+// our own so the check leaves the state of rand() alone.
+static double check_random(unsigned long long *state)
+{
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(*state >> 11) / 9007199254740992.0 - 0.5;
+}
+
+// Multiply random matrices with every kernel the CPU supports, the
+// scalar one included, and compare against a plain triple loop. The
+// sizes are odd, so no dimension is a multiple of MR, NR or KC, and k is
+// over KC, so all edge cases of the micro tiles and cache blocks are
+// exercised. c starts nonzero, gemm adds to it.
+int gemm_check(void)
+{
+	const int m = 131, n = 77, k = 301;
+	const int lda = k + 1, ldb = n + 3, ldc = n + 2;
+	double *a = malloc(sizeof(double) * m * lda);
+	double *b = malloc(sizeof(double) * k * ldb);
+	double *c0 = malloc(sizeof(double) * m * ldc);
+	double *ref = malloc(sizeof(double) * m * ldc);
+	double *c = malloc(sizeof(double) * m * ldc);
+	unsigned long long state = 1;
+	int failures = 0;
+	int i, j, p, kern;
+
+	for (i = 0; i < m * lda; i++)
+	{
+		a[i] = check_random(&state);
+	}
+	for (i = 0; i < k * ldb; i++)
+	{
+		b[i] = check_random(&state);
+	}
+	for (i = 0; i < m * ldc; i++)
+	{
+		c0[i] = check_random(&state);
+	}
+
+	for (i = 0; i < m; i++)
+	{
+		for (j = 0; j < n; j++)
+		{
+			double sum = c0[i * ldc + j];
+			for (p = 0; p < k; p++)
+			{
+				sum += a[i * lda + p] * b[p * ldb + j];
+			}
+			ref[i * ldc + j] = sum;
+		}
+	}
+
+	for (kern = 0; kern < NUM_KERNELS; kern++)
+	{
+		double maxError = 0.0;
+
+		if (!kernels[kern].supported())
+		{
+			continue;
+		}
+
+		memcpy(c, c0, sizeof(double) * m * ldc);
+		gemm_with_kernel(&kernels[kern], m, n, k, a, lda, b, ldb, c, ldc);
+
+		for (i = 0; i < m; i++)
+		{
+			for (j = 0; j < n; j++)
+			{
+				double error = fabs(c[i * ldc + j] - ref[i * ldc + j]);
+				if (error > maxError)
+				{
+					maxError = error;
+				}
+			}
+		}
+
+		// Only the summation order differs, so the results agree to rounding.
+		if (maxError > 1e-10)
+		{
+			printf("[FAILURE] gemm kernel %s differs from the reference by %g\n", kernels[kern].name, maxError);
+			failures++;
+		}
+	}
+
+	free(a);
+	free(b);
+	free(c0);
+	free(ref);
+	free(c);
+	return failures;
+}
@@ -0,0 +1,18 @@
+// Shared matrix multiplication kernel used by matmul_seq.c and matmul_mpi.c.
+
+#ifndef GEMM_H
+#define GEMM_H
+
+// c += a * b, where a is (m x k), b is (k x n) and c is (m x n).
+// All matrices are stored row by row, ldX is the row stride of X.
+void gemm(int m, int n, int k, const double *a, int lda,
+	const double *b, int ldb, double *c, int ldc);
+
+// Name of the micro kernel picked for this CPU.
+const char *gemm_kernel_name(void);
+
+// Compare every kernel the CPU supports against a plain triple loop.
+// Returns the number of kernels that gave a wrong result.
+int gemm_check(void);
+
+#endif
@@ -0,0 +1,277 @@
+// Grids and the red-black SOR kernels on them, in double and single precision.
+//
+// Every SOR variant in the programs, sequential, threaded, distributed or
+// temporally blocked, comes down to updating one color of one row, so
+// that is the unit the kernels work on. The elements of a color are every
+// second one, the loops step by two instead of testing the color of each
+// element. The arithmetic is the same, in the same order, as the loops
+// the kernels replace, so the results are bit for bit the same.
+
+#include <stdlib.h>
+#include <math.h>
+#include "grid.h"
+
+// Elements of one color updated before their changes are measured. The
+// update loop then has no reduction in it and vectorizes; the changes
+// wait in a buffer on the stack that stays in the L1 cache.
+#define GRID_CHUNK 256
+
+// Largest of max and v[0..count-1]. Each of the GRID_LANES lanes keeps
+// its own maximum, so the compares vectorize; the maximum does not depend
+// on the order, so the result is the same as that of a plain loop.
+#define GRID_LANES 8
+
+static double max_of(const double *v, int count, double max)
+{
+	double lane[GRID_LANES];
+	int i, l;
+
+	for (l = 0; l < GRID_LANES; l++)
+	{
+		lane[l] = max;
+	}
+	for (i = 0; i + GRID_LANES <= count; i += GRID_LANES)
+	{
+		for (l = 0; l < GRID_LANES; l++)
+		{
+			lane[l] = (v[i + l] > lane[l]) ? v[i + l] : lane[l];
+		}
+	}
+	for (; i < count; i++)
+	{
+		max = (v[i] > max) ? v[i] : max;
+	}
+	for (l = 0; l < GRID_LANES; l++)
+	{
+		max = (lane[l] > max) ? lane[l] : max;
+	}
+
+	return max;
+}
+
+// sum + v[0]^2 + ... + v[count-1]^2, added in order.
+static double sum_of_squares(const double *v, int count, double sum)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		sum += v[i] * v[i];
+	}
+
+	return sum;
+}
+
+double *grid_alloc(int rows, int cols, int *stride)
+{
+	int line = GRID_ALIGN / sizeof(double);
+	int width = cols;
+	size_t bytes;
+	void *ptr = NULL;
+
+	if (stride != NULL)
+	{
+		width = (cols + line - 1) / line * line;
+		if ((width * sizeof(double)) % 4096 == 0)
+		{
+			width += line;
+		}
+		*stride = width;
+	}
+
+	bytes = sizeof(double) * (size_t)rows * width;
+	if (bytes == 0)
+	{
+		bytes = sizeof(double);
+	}
+	if (posix_memalign(&ptr, GRID_ALIGN, bytes) != 0)
+	{
+		return NULL;
+	}
+
+	return ptr;
+}
+
+void grid_sor_row(double *row, const double *up, const double *down, int first, int last,
+	double w, double *delta, double *sumsq)
+{
+	double old, change[GRID_CHUNK];
+	int c, k, n, count;
+
+	if (delta == NULL)
+	{
+		for (n = first; n <= last; n += 2)
+		{
+			row[n] = (1 - w) * row[n]
+				+ w * (up[n] + down[n] + row[n - 1] + row[n + 1]) / 4;
+		}
+		return;
+	}
+
+	for (c = first; c <= last; c += 2 * GRID_CHUNK)
+	{
+		count = (last - c) / 2 + 1;
+		if (count > GRID_CHUNK)
+		{
+			count = GRID_CHUNK;
+		}
+		for (k = 0; k < count; k++)
+		{
+			n = c + 2 * k;
+			old = row[n];
+			row[n] = (1 - w) * row[n]
+				+ w * (up[n] + down[n] + row[n - 1] + row[n + 1]) / 4;
+			change[k] = fabs(row[n] - old);
+		}
+		*delta = max_of(change, count, *delta);
+		if (sumsq != NULL)
+		{
+			*sumsq = sum_of_squares(change, count, *sumsq);
+		}
+	}
+}
+
+void grid_sor_row_split(double *x, const double *up, const double *down, const double *y,
+	int first, int last, int s, double w, double *delta, double *sumsq)
+{
+	double old, change[GRID_CHUNK];
+	int c, i, k, count;
+
+	if (delta == NULL)
+	{
+		for (k = first; k <= last; k++)
+		{
+			x[k] = (1 - w) * x[k]
+				+ w * (up[k] + down[k] + y[k - 1 + s] + y[k + s]) / 4;
+		}
+		return;
+	}
+
+	for (c = first; c <= last; c += GRID_CHUNK)
+	{
+		count = last - c + 1;
+		if (count > GRID_CHUNK)
+		{
+			count = GRID_CHUNK;
+		}
+		for (i = 0; i < count; i++)
+		{
+			k = c + i;
+			old = x[k];
+			x[k] = (1 - w) * x[k]
+				+ w * (up[k] + down[k] + y[k - 1 + s] + y[k + s]) / 4;
+			change[i] = fabs(x[k] - old);
+		}
+		*delta = max_of(change, count, *delta);
+		if (sumsq != NULL)
+		{
+			*sumsq = sum_of_squares(change, count, *sumsq);
+		}
+	}
+}
+
+double grid_row_sum(const double *row, int first, int last)
+{
+	double sum = 0.0;
+	int n;
+
+	for (n = first; n <= last; n++)
+	{
+		sum += row[n];
+	}
+
+	return sum;
+}
+
+void grid_sor_row_float(float *row, const float *up, const float *down, int first, int last,
+	float w, double *delta, double *sumsq)
+{
+	float old;
+	double change[GRID_CHUNK];
+	int c, k, n, count;
+
+	if (delta == NULL)
+	{
+		for (n = first; n <= last; n += 2)
+		{
+			row[n] = (1 - w) * row[n]
+				+ w * (up[n] + down[n] + row[n - 1] + row[n + 1]) / 4;
+		}
+		return;
+	}
+
+	for (c = first; c <= last; c += 2 * GRID_CHUNK)
+	{
+		count = (last - c) / 2 + 1;
+		if (count > GRID_CHUNK)
+		{
+			count = GRID_CHUNK;
+		}
+		for (k = 0; k < count; k++)
+		{
+			n = c + 2 * k;
+			old = row[n];
+			row[n] = (1 - w) * row[n]
+				+ w * (up[n] + down[n] + row[n - 1] + row[n + 1]) / 4;
+			change[k] = fabs(row[n] - old);
+		}
+		*delta = max_of(change, count, *delta);
+		if (sumsq != NULL)
+		{
+			*sumsq = sum_of_squares(change, count, *sumsq);
+		}
+	}
+}
+
+void grid_sor_row_split_float(float *x, const float *up, const float *down, const float *y,
+	int first, int last, int s, float w, double *delta, double *sumsq)
+{
+	float old;
+	double change[GRID_CHUNK];
+	int c, i, k, count;
+
+	if (delta == NULL)
+	{
+		for (k = first; k <= last; k++)
+		{
+			x[k] = (1 - w) * x[k]
+				+ w * (up[k] + down[k] + y[k - 1 + s] + y[k + s]) / 4;
+		}
+		return;
+	}
+
+	for (c = first; c <= last; c += GRID_CHUNK)
+	{
+		count = last - c + 1;
+		if (count > GRID_CHUNK)
+		{
+			count = GRID_CHUNK;
+		}
+		for (i = 0; i < count; i++)
+		{
+			k = c + i;
+			old = x[k];
+			x[k] = (1 - w) * x[k]
+				+ w * (up[k] + down[k] + y[k - 1 + s] + y[k + s]) / 4;
+			change[i] = fabs(x[k] - old);
+		}
+		*delta = max_of(change, count, *delta);
+		if (sumsq != NULL)
+		{
+			*sumsq = sum_of_squares(change, count, *sumsq);
+		}
+	}
+}
+
+double grid_row_sum_float(const float *row, int first, int last)
+{
+	double sum = 0.0;
+	int n;
+
+	for (n = first; n <= last; n++)
+	{
+		sum += row[n];
+	}
+
+	return sum;
+}
@@ -0,0 +1,43 @@
+// Grids and the red-black SOR kernels on them, in double and single
+// precision, shared by sor_seq.c, laplace_mpi.c and matmul_mpi.c.
+
+#ifndef GRID_H
+#define GRID_H
+
+#define GRID_ALIGN 64
+
+// A (rows x cols) array, aligned to a cache line. With stride set every
+// row is padded to *stride doubles, a whole number of cache lines that is
+// not a multiple of 4 KiB, so the rows above and below do not compete for
+// the same cache sets; without it the rows are packed. The elements are
+// not initialized: the caller's first write places the pages, on the NUMA
+// node of the thread that writes them. Returns NULL when out of memory,
+// free() it.
+double *grid_alloc(int rows, int cols, int *stride);
+
+// One color of one row: row[n] for n = first, first + 2, ... up to last
+// gets the SOR update with factor w from its neighbours in up, down and
+// row. With delta set the largest change is kept in *delta, and with
+// sumsq set as well the squares of the changes are added to *sumsq.
+void grid_sor_row(double *row, const double *up, const double *down, int first, int last,
+	double w, double *delta, double *sumsq);
+
+// Same for the colour split layout, where each color has its own array.
+// x[k] (first <= k <= last) of one color has the neighbours up[k] and
+// down[k] above and below, and y[k - 1 + s] and y[k + s] to the left and
+// right, in the arrays of the other color.
+void grid_sor_row_split(double *x, const double *up, const double *down, const double *y,
+	int first, int last, int s, double w, double *delta, double *sumsq);
+
+// row[first] + ... + row[last].
+double grid_row_sum(const double *row, int first, int last);
+
+// The same three in single precision, for the float sweeps of the mixed
+// precision solver. The changes and the sum are kept in double.
+void grid_sor_row_float(float *row, const float *up, const float *down, int first, int last,
+	float w, double *delta, double *sumsq);
+void grid_sor_row_split_float(float *x, const float *up, const float *down, const float *y,
+	int first, int last, int s, float w, double *delta, double *sumsq);
+double grid_row_sum_float(const float *row, int first, int last);
+
+#endif
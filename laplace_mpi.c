@@ -1,112 +1,259 @@
-
-/* TODO
-2. Divide into blocks for 2 and 4 processors
-3. Send blocks to other nodes
-4. Each node calculates their block, row by row
-5. Exchange row values with adjacent blocks (Note: Use Sendreceive to avoid deadlock!)
-6. Check acceptance value, if we have not passed it yet, goto 4
-7. If we pass the acceptance value, add everything together into one matrix
-*/
+/*
+ * Red-Black SOR solution to the LaPlace approximation, distributed with MPI.
+ *
+ * 1. All nodes are arranged in a 2D grid, and the matrix is divided into
+ *    one block per node (blocks differ by at most one row/column).
+ * 2. Each node fills its own block, including a ghost row/column on every
+ *    side, so the full matrix never has to exist on a single node.
+ * 3. Each node calculates the red or black elements of its block.
+ * 4. Border rows/columns are exchanged with the adjacent blocks after every
+ *    color. The sends and receives are persistent requests set up once,
+ *    and all of them are started together. With -g the ghost zone is
+ *    several rows/columns wide, it is exchanged every g colors and the
+ *    nodes compute the overlap with their neighbours themselves in between.
+ * 5. The maximum row sum is reduced over all nodes, and every node compares
+ *    it with the acceptance value, so all nodes stop at the same iteration.
+ *    The reductions are nonblocking and overlap the following sweeps, and
+ *    with -k they are only done every k sweeps.
+ * 6. If printing is switched on, all blocks are gathered into one matrix.
+ *
+ * With -t each node runs a team of threads on its block, so one node per
+ * socket or machine is enough. Only the master thread talks to MPI
+ * (MPI_THREAD_FUNNELED): it exchanges the halo while the other threads
+ * update the interior of the block.
+ *
+ * With a single node and a single thread the master runs the sequential
+ * version instead.
+ *
+ * With -i every node times the phases of the distributed version, and the
+ * master prints how they are spread over the nodes; -T also writes a
+ * Chrome trace of them.
+ */
 
 #include <stdio.h>
-#include <stdlib.h> 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <mpi.h>
-
+#include "timing.h"
+#include "counters.h"
+#include "grid.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Default size, can be changed with -n.
 #define SIZE 8
-#define SIZEWITHBORDERS (SIZE + 2)
-#define DIFFERANCELIMIT (0.00001 * SIZE)
 
 #define FILLTYPE "Random"
 #define MAXRANDOM 15
+#define MAXITERATIONS 100000
 
-#define MAX_PROCESSORS 4
 #define DEBUG 1
 #define EVEN 0
 #define ODD 1
 
-static double A[SIZEWITHBORDERS][SIZEWITHBORDERS];
-int processorRank;
+// Matrix size (without borders) and stop condition.
+static int size = SIZE;
+static int sizeWithBorders;
+static double differenceLimit;
+static int printSwitch = DEBUG;
+
+// Relaxation factor, can be changed with -w. "-w auto" uses the optimum
+// for the matrix size, 2 / (1 + sin(pi / (size + 1))).
+static double relaxation = 0.5;
+static int autoRelaxation = 0;
+
+// Check for convergence every checkInterval sweeps, can be changed with -k.
+static int checkInterval = 1;
+
+// Keep red and black elements in separate arrays in the sequential
+// version, switched on with -S 1.
+static int splitColors = 0;
+
+// Threads per node, can be changed with -t.
+static int threads = 1;
+
+// Solver, "sor" or "cg", and the preconditioner for CG, "jacobi" or
+// "ssor". Can be changed with -s and -p.
+static char *solver = "sor";
+static char *preconditioner = "ssor";
 
-MPI_Status status;
+// Rows/columns of ghost cells on every side of a block, can be changed
+// with -g. The halo is exchanged every ghostWidth sweeps.
+static int ghostWidth = 1;
 
+// Per-phase timing (-i), and a trace of every phase (-T file).
+enum { PHASE_COMPUTE, PHASE_HALO_START, PHASE_HALO_WAIT, PHASE_ROW_SUMS, PHASE_REDUCE, PHASE_GATHER, PHASES };
+static const char *const phaseNames[PHASES] = { "compute", "halo start", "halo wait", "row sums", "reduce", "gather" };
+static int timing = 0;
+static const char *traceFile = NULL;
+
+// Hardware counters around the solver (KERNEL_COUNTERS=1).
+static struct counter_region solverRegion;
+
+// Full matrix, (size + 2) x (size + 2). Only allocated on the master,
+// and only when it runs alone or has to print the result.
+static double *A;
+
+int processorRank;
+int processorsAvailable;
+
+// Process grid and the neighbouring nodes (MPI_PROC_NULL at the border).
+static MPI_Comm gridComm = MPI_COMM_NULL, rowComm = MPI_COMM_NULL;
+static int gridRows, gridCols;
+static int myRow, myCol;
+static int north, south, west, east;
+static int northWest, northEast, southWest, southEast;
+
+// This node's block, with ghostWidth ghost rows/columns on every side. Row
+// m of the block is row (rowOffset + m + 1 - ghostWidth) of the full
+// matrix, likewise for columns. Rows are blockWidth doubles apart, padded
+// past the ghost columns to whole cache lines by grid_alloc().
+static int blockRows, blockCols;
+static int rowOffset, colOffset;
+static int blockWidth;
+static double *block;
+
+// Partial row sums for the convergence check: the current sweep, the last
+// sweep of each color, and the buffer being reduced.
+static double *rowSums;
+static double *previousSums[2];
+static double *stageOneSums;
+
+// The ghost rows, ghost columns and ghost corners of the block.
+static MPI_Datatype rowsType, columnsType, cornerType;
+
+// Persistent requests for the halo exchange, created once by SetupHalo().
+// The corners are only needed with more than one ghost row/column.
+#define HALO_REQUESTS 16
+static MPI_Request haloRequests[HALO_REQUESTS];
+static int haloCount;
+static long haloBytes;	// Bytes sent by one halo exchange.
+
+void ReadOptions(int argc, char **argv);
+double FillValue(int i, int j);
 void InitializeMatrix();
 void PrintMatrix();
 int SequentialApproximation();
+int SplitApproximation();
+void SetupGrid();
+void InitializeBlock();
+int SetupHalo(double *field, MPI_Request *requests);
+void SweepRectangle(int firstRow, int lastRow, int firstCol, int lastCol, int color, double w);
+void PartialRowSums(double *sums);
+int LaplaceOverBlock();
+int ConjugateGradient();
+void GatherMatrix();
+void ReportCounters(int iterations);
 
 int main(int argc, char **argv)
 {
 	int iterations = 0;
+	int provided;
 
-	double startTime = 0; 
+	double startTime = 0;
 	double endTime	 = 0;
 	double totalTime = 0;
 
-	int processorsAvailable;
-
-	// Generate the matrix.
-	InitializeMatrix();
-
-	// Initialize MPI API.
-    MPI_Init(&argc, &argv);
+	// Initialize MPI API, only the master thread of each node makes MPI calls.
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 	MPI_Comm_rank(MPI_COMM_WORLD, &processorRank);
 	MPI_Comm_size(MPI_COMM_WORLD, &processorsAvailable);
 
-	// Ask for number of processors to be used. Loop if input is invalid.
-	int processorsUsed = 1;
-	while (processorsUsed != 1 && processorsUsed != 2 && processorsUsed != 4)
+	ReadOptions(argc, argv);
+
+	if (threads > 1 && provided < MPI_THREAD_FUNNELED)
 	{
-		fflush(stdin);
-		printf("How many processors should be used in the cluster? [1, 2, 4]: ");
-		scanf("%d", &processorsUsed);
+		if (processorRank == 0)
+		{
+			printf("The MPI library does not support threads, using 1 thread per node.\n");
+		}
+		threads = 1;
 	}
-	
-	//==================================================//
-	//          V V V MASTERS CODE BLOCK V V V			//
-	//==================================================//
-	if(processorRank == 0)
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#else
+	threads = 1;
+#endif
+	counters_open(&solverRegion, solver);
+
+	// 1 processor used, the master does all the work (SEQUENTIAL).
+	if (processorsAvailable == 1 && threads == 1 && strcmp(solver, "cg") != 0)
 	{
-		if(DEBUG)
+		// Generate the matrix.
+		InitializeMatrix();
+
+		if (DEBUG)
 		{
-			printf("%d processors will be used.\n", processorsUsed);
 			printf("\n>> Running LaPlace approximation...\n\n");
 		}
-		  
+
 		// Start the timer.
 		startTime = MPI_Wtime();
+		counters_start(&solverRegion);
 
-		// 1 processor used, the master does all the work (SEQUENTIAL).
-		if(processorsUsed == 1)
-		{
-			// Start the timer.
-			startTime = MPI_Wtime();
+		iterations = splitColors ? SplitApproximation() : SequentialApproximation();
 
-			iterations = SequentialApproximation();
+		// Stop the timer.
+		counters_stop(&solverRegion);
+		endTime = MPI_Wtime();
+	}
 
-			// If we reached to many iterations, quit.
-			if(iterations > 100000)
-			{
-				return 0;
-			}
-		}
+	// Several processors used, every node works on its own block.
+	else
+	{
+		SetupGrid();
+		InitializeBlock();
 
-		// 2 processors used, the master and one worker.
-		else if(processorsUsed == 2)
+		if (processorRank == 0 && DEBUG)
 		{
-			iterations = MasterBlockedApproximation(2);
+			printf("Matrix size (without borders): %d x %d\n", size, size);
+			printf("Differance limit: %.7lf\n", differenceLimit);
+			printf("Relaxation factor: %f\n", relaxation);
+			printf("%d processors will be used, as a %d x %d grid.\n", processorsAvailable, gridRows, gridCols);
+			printf("%d threads per processor.\n", threads);
+			printf("Ghost width: %d\n", ghostWidth);
+			printf("Solver: %s\n", solver);
+			printf("\n>> Running LaPlace approximation...\n\n");
 		}
 
-		// 4 processors used, the master and all three workers.
-		else if(processorsUsed == 4)
+		if (timing)
 		{
-			iterations = MasterBlockedApproximation(4);
+			timing_init(gridComm, PHASES, phaseNames, traceFile);
 		}
 
+		// Start the timer.
+		MPI_Barrier(gridComm);
+		startTime = MPI_Wtime();
+		counters_start(&solverRegion);
+
+		iterations = (strcmp(solver, "cg") == 0) ? ConjugateGradient() : LaplaceOverBlock();
+
 		// Stop the timer.
+		counters_stop(&solverRegion);
 		endTime = MPI_Wtime();
 
-		printf("[SUCCESS] LaPlace approximation finished.\n");
+		if (printSwitch)
+		{
+			GatherMatrix();
+		}
+		timing_report();
+	}
+
+	if (processorRank == 0)
+	{
+		if (iterations > MAXITERATIONS)
+		{
+			printf("[FAILURE] Maximum number of iterations reached before convergance.\n");
+			printf("Change parameters and try again...\n");
+		}
+		else
+		{
+			printf("[SUCCESS] LaPlace approximation finished.\n");
+		}
 
-		if(DEBUG)
+		if (printSwitch)
 		{
 			printf("\n>> Printing matrix... \n\n");
 			PrintMatrix();
@@ -114,161 +261,255 @@ int main(int argc, char **argv)
 
 		// Output time taken.
 		totalTime = (endTime - startTime);
-		printf("Execution time on %2d nodes: %f\n", processorsUsed, totalTime);
-	}
-	//==================================================//
-	//          ^ ^ ^ MASTERS CODE BLOCK ^ ^ ^ 			//
-	//==================================================//
-	
-	//==================================================//
-	//          V V V WORKER CODE BLOCK V V V			//
-	//==================================================//
-	else if(processorRank < processorsUsed)
-	{
-		// 2 processors used, the master and one worker.
-		if(processorsUsed == 2)
-		{
-			// Worker 2 part.
-			if(processorRank == 1)
-			{
-				WorkerBlockedApproximation();
-			}
+		printf("Number of iterations = %d\n", iterations);
+		printf("Execution time on %2d nodes: %f\n", processorsAvailable, totalTime);
+	}
+	ReportCounters(iterations);
+
+	free(A);
+	free(block);
+	free(rowSums);
+	free(previousSums[EVEN]);
+	free(previousSums[ODD]);
+	free(stageOneSums);
+	if (gridComm != MPI_COMM_NULL)
+	{
+		int i;
+		for (i = 0; i < haloCount; i++)
+		{
+			MPI_Request_free(&haloRequests[i]);
 		}
+		MPI_Type_free(&rowsType);
+		MPI_Type_free(&columnsType);
+		MPI_Type_free(&cornerType);
+		MPI_Comm_free(&rowComm);
+		MPI_Comm_free(&gridComm);
+	}
+
+	// Finalize the MPI API, and then quit.
+	MPI_Finalize();
+	return 0;
+}
 
-		// 4 processors used, the master and all three workers.
-		else if(processorsUsed == 4)
+void ReadOptions(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
 		{
-			// Worker 2 part.
-			if(processorRank == 1)
+			continue;
+		}
+
+		switch (argv[i][1])
+		{
+		case 'n':
+			if (i + 1 < argc)
 			{
-				WorkerBlockedApproximation();
+				size = atoi(argv[++i]);
 			}
-
-			// Worker 3 part.
-			else if(processorRank == 2)
+			break;
+		case 'P':
+			if (i + 1 < argc)
 			{
-				WorkerBlockedApproximation();
+				printSwitch = atoi(argv[++i]);
 			}
-
-			// Worker 4 part.
-			else if(processorRank == 3)
+			break;
+		case 'k':
+			if (i + 1 < argc)
+			{
+				checkInterval = atoi(argv[++i]);
+			}
+			break;
+		case 'S':
+			if (i + 1 < argc)
+			{
+				splitColors = atoi(argv[++i]);
+			}
+			break;
+		case 't':
+			if (i + 1 < argc)
+			{
+				threads = atoi(argv[++i]);
+			}
+			break;
+		case 's':
+			if (i + 1 < argc)
+			{
+				solver = argv[++i];
+			}
+			break;
+		case 'p':
+			if (i + 1 < argc)
+			{
+				preconditioner = argv[++i];
+			}
+			if (strcmp(preconditioner, "jacobi") != 0 && strcmp(preconditioner, "ssor") != 0)
+			{
+				if (processorRank == 0)
+				{
+					printf("%s: unknown preconditioner %s, use jacobi or ssor\n", argv[0], preconditioner);
+				}
+				MPI_Finalize();
+				exit(1);
+			}
+			break;
+		case 'w':
+			if (i + 1 < argc)
+			{
+				i++;
+				autoRelaxation = (strcmp(argv[i], "auto") == 0);
+				relaxation = autoRelaxation ? relaxation : atof(argv[i]);
+			}
+			break;
+		case 'g':
+			if (i + 1 < argc)
 			{
-				WorkerBlockedApproximation();
+				ghostWidth = atoi(argv[++i]);
 			}
+			break;
+		case 'i':
+			timing = 1;
+			break;
+		case 'T':
+			if (i + 1 < argc)
+			{
+				timing = 1;
+				traceFile = argv[++i];
+			}
+			break;
+		case 'h':
+		case 'u':
+			if (processorRank == 0)
+			{
+				printf("\nUsage: laplace [-n problemsize]\n");
+				printf("               [-P print_switch] 0/1 \n");
+				printf("               [-k check_interval] sweeps between convergence checks \n");
+				printf("               [-S split_colors] 0/1, sequential version only \n");
+				printf("               [-t threads] threads per node \n");
+				printf("               [-g ghost_width] sweeps between halo exchanges \n");
+				printf("               [-w relaxation_factor] or auto \n");
+				printf("               [-s solver] sor/cg \n");
+				printf("               [-p preconditioner] jacobi/ssor, for cg; ssor on one strip of rows per thread \n");
+				printf("               [-i] time the phases on every node \n");
+				printf("               [-T file] -i, and write a Chrome trace of the phases \n\n");
+			}
+			MPI_Finalize();
+			exit(0);
+		default:
+			if (processorRank == 0)
+			{
+				printf("%s: ignored option: %s\n", argv[0], argv[i]);
+			}
+			break;
 		}
 	}
-	//==================================================//
-	//          ^ ^ ^  WORKER CODE BLOCK ^ ^ ^ 			//
-	//==================================================//
-
-	// Finalize the MPI API, and then quit.
-	MPI_Finalize();
-    return 0;
-}
 
-void InitializeMatrix()
-{
-	// If we are in debug mode, print matrix definitions.
-	if(DEBUG)
+	if (size < 1)
+	{
+		size = SIZE;
+	}
+	if (checkInterval < 1)
+	{
+		checkInterval = 1;
+	}
+	if (threads < 1)
 	{
-		printf("Matrix size (without borders): %d x %d\n", SIZE, SIZE);
-		printf("Matrix size (with borders): %d x %d\n", SIZEWITHBORDERS, SIZEWITHBORDERS);
-		printf("Differance limit: %.7lf\n", DIFFERANCELIMIT);
+		threads = 1;
+	}
+	if (ghostWidth < 1)
+	{
+		ghostWidth = 1;
+	}
 
-		printf("Method for filling the matrix: %s\n", FILLTYPE);
-		if(FILLTYPE == "Random")
-		{
-			printf("Maximum random value: %f\n", MAXRANDOM);
-		}
+	sizeWithBorders = size + 2;
+	differenceLimit = 0.00001 * size;
 
-		printf("\n>> Initializing matrix...\n\n");
+	// Spectral radius of Jacobi on this grid is cos(pi / (size + 1)).
+	if (autoRelaxation)
+	{
+		relaxation = 2.0 / (1.0 + sin(M_PI / (size + 1)));
 	}
- 
-    // Initialize all matrix elements to 0.0.
-	int i;
-	int j;
+}
 
-    for (i = 0; i < SIZEWITHBORDERS; i++) 
+// Value of element (i, j) of the initial matrix, 1 <= i, j <= size.
+// It only depends on the position, so every node can fill its own block.
+double FillValue(int i, int j)
+{
+	// Incrementing elements.
+	if (strcmp(FILLTYPE, "Counting") == 0)
 	{
-		for (j = 0; j < SIZEWITHBORDERS; j++) 
-		{
-			A[i][j] = 0.0;
-		}
-    }
+		return (double)(i / 2);
+	}
 
-	// Fill the matrix with incrementing elements.
-    if (FILLTYPE == "Counting") 
+	// Alternating elements, counting one extra step per row.
+	if (strcmp(FILLTYPE, "Quickly") == 0)
 	{
-		for (i = 1; i < SIZE + 1; i++)
-		{
-			for (j = 1; j < SIZE + 1; j++) 
-			{
-				A[i][j] = (double)(i / 2);
-			}
-		}
-    }
+		int count = (i - 1) * (size + 1) + 1 + j;
+		return ((count % 2) == 0) ? 1.0 : 5.0;
+	}
 
-	// Fill the matrix quickly.
-	int count = 0;
-    if (FILLTYPE == "Quickly") 
+	// Random elements, from a hash of the position instead of rand().
+	if (strcmp(FILLTYPE, "Random") == 0)
 	{
-		for (i = 1; i < SIZE + 1; i++)
-		{
-			count++;
+		unsigned int hash = (unsigned int)i * 73856093u ^ (unsigned int)j * 19349663u;
+		hash ^= hash >> 13;
+		hash *= 0x5bd1e995u;
+		hash ^= hash >> 15;
+		return (double)(hash % MAXRANDOM) + 1.0;
+	}
 
-			for (j = 1; j < SIZE + 1; j++) 
-			{
-				count++;
+	return 0.0;
+}
 
-				// Even elements.
-				if ((count % 2) == 0)
-				{
-					A[i][j] = 1.0;
-				}
+// Value of element (i, j) including the border, 0 <= i, j <= size + 1.
+// The border has the same values as the outermost rows/columns.
+static double InitialValue(int i, int j)
+{
+	if (i < 1)		i = 1;
+	if (i > size)	i = size;
+	if (j < 1)		j = 1;
+	if (j > size)	j = size;
 
-				// Odd elements.
-				else
-				{
-					A[i][j] = 5.0;
-				}
-			}
-		}
-    }
+	return FillValue(i, j);
+}
 
-	// Fill the matrix with random elements
-    if (FILLTYPE == "Random") 
+void InitializeMatrix()
+{
+	// If we are in debug mode, print matrix definitions.
+	if (DEBUG)
 	{
-		for (i = 1; i < SIZE + 1; i++)
+		printf("Matrix size (without borders): %d x %d\n", size, size);
+		printf("Matrix size (with borders): %d x %d\n", sizeWithBorders, sizeWithBorders);
+		printf("Differance limit: %.7lf\n", differenceLimit);
+		printf("Relaxation factor: %f\n", relaxation);
+
+		printf("Method for filling the matrix: %s\n", FILLTYPE);
+		if (strcmp(FILLTYPE, "Random") == 0)
 		{
-			for (j = 1; j < SIZE + 1; j++) 
-			{
-				A[i][j] = (rand() % MAXRANDOM) + 1.0;
-			}
+			printf("Maximum random value: %d\n", MAXRANDOM);
 		}
-    }
 
-	// Edit the matrix corners.
-    A[0][0]			  = A[1][1];
-    A[0][SIZE+1]	  = A[1][SIZE];
-    A[SIZE+1][0]	  = A[SIZE][1];
-    A[SIZE+1][SIZE+1] = A[SIZE][SIZE];
+		printf("\n>> Initializing matrix...\n\n");
+	}
 
-    // Edit the top and bottom rows.
-    for (i = 1; i < SIZE + 1; i++) 
-	{
-		A[0][i]		 = A[1][i];
-		A[SIZE+1][i] = A[SIZE][i];
-    }
+	int i;
+	int j;
 
-    // Edit the left and right columns.
-    for (i = 1; i < SIZE + 1; i++) 
+	A = grid_alloc(sizeWithBorders, sizeWithBorders, NULL);
+
+	// Fill all elements, including the borders.
+	for (i = 0; i < sizeWithBorders; i++)
 	{
-		A[i][0]		 = A[i][1];
-		A[i][SIZE+1] = A[i][SIZE];
-    }
+		for (j = 0; j < sizeWithBorders; j++)
+		{
+			A[i * sizeWithBorders + j] = InitialValue(i, j);
+		}
+	}
 
 	// If we are in debug mode, pring matrix.
-	if(DEBUG)
+	if (DEBUG && printSwitch)
 	{
 		printf("Initialization done!\n");
 		printf("\n>> Printing matrix... \n\n");
@@ -282,513 +523,953 @@ void PrintMatrix()
 	int j;
 
 	// Iterate through the matrix and print it.
-    for (i = 0; i < SIZEWITHBORDERS ;i++)
+	for (i = 0; i < sizeWithBorders; i++)
 	{
-		for (j = 0; j < SIZEWITHBORDERS ;j++)
+		for (j = 0; j < sizeWithBorders; j++)
 		{
-			printf(" %f", A[i][j]);
+			printf(" %f", A[i * sizeWithBorders + j]);
 		}
-		
+
 		printf("\n");
 	}
 
-    printf("\n\n");
+	printf("\n\n");
 }
 
 int SequentialApproximation()
 {
-	double previousMaximum_EVEN = 0.0;
-	double previousMaximum_ODD = 0.0;
+	double previousMaximum[2] = { 0.0, 0.0 };
 	double maximum = 0.0;
 	double sum = 0.0;
-	double w = 0.5;
+	double w = relaxation;
 
-    int	m, n, i;
-    int turn = EVEN;
-    int iteration = 0;
+	int	m;
+	int turn = EVEN;
+	int iteration = 0;
 	int finished = 0;
-    
+	int W = sizeWithBorders;
+
 	// Approximate until finished.
-    while(!finished) 
+	while (!finished)
 	{
 		iteration++;
 
-		// Calculate even elements.
-		if(turn == EVEN) 
+		// Calculate the elements of this color, in row m they start at n = 1 or 2.
+		for (m = 1; m < size + 1; m++)
 		{
-			for(m = 1; m < SIZE + 1; m++) 
-			{
-				for(n = 1; n < SIZE + 1; n++) 
-				{
-					if(((m + n) % 2) == 0)
-					{
-						// Perform average operation, using the elements 4 neighbours.
-						A[m][n] = (1 - w) * A[m][n] + w * (A[m-1][n] + A[m+1][n] + A[m][n-1] + A[m][n+1]) / 4;
-					}
-				}
-			}
-
-			// Calculate the maximum sum of the elements.
-			maximum = -999999.0;
-			for(m = 1; m < SIZE + 1; m++) 
-			{
-				sum = 0.0;
-
-				for(n = 1; n < SIZE + 1; n++)
-				{
-					sum += A[m][n];
-				}
+			grid_sor_row(&A[m * W], &A[(m - 1) * W], &A[(m + 1) * W], 1 + (m + 1 + turn) % 2, size, w, NULL, NULL);
+		}
 
-				if(sum > maximum)
-				{
-					maximum = sum;
-				}
-			}
+		// Calculate the maximum sum of the elements.
+		maximum = -999999.0;
+		for (m = 1; m < size + 1; m++)
+		{
+			sum = grid_row_sum(&A[m * W], 1, size);
 
-			// Check wether the approximation is finished or not, by comparing the even sum with the previous sum.
-			if(fabs(maximum - previousMaximum_EVEN) <= DIFFERANCELIMIT)
+			if (sum > maximum)
 			{
-				finished = 1;
+				maximum = sum;
 			}
+		}
 
-			// Print debug information if flaged.
-			if(DEBUG && (iteration % 100) == 0)
-			{
-				printf("Iteration: %d, maximum: %f, previous (even) maximum: %f\n", iteration, maximum, previousMaximum_EVEN);
-			}
+		// Check wether the approximation is finished or not, by comparing with the previous sum of this color.
+		if (fabs(maximum - previousMaximum[turn]) <= differenceLimit)
+		{
+			finished = 1;
+		}
 
-			// Prepare for next iteration.
-			previousMaximum_EVEN = maximum;
-			turn = ODD;
-		} 
-	
-		// Calculate odd elements.
-		else if(turn == ODD) 
-		{
-			for(m = 1; m < SIZE + 1; m++) 
-			{
-				for(n = 1; n < SIZE + 1; n++) 
-				{
-					if(((m + n) % 2) == 1)
-					{
-						// Perform average operation, using the elements 4 neighbours.
-						A[m][n] = (1 - w) * A[m][n] + w * (A[m-1][n] + A[m+1][n] + A[m][n-1] + A[m][n+1]) / 4;
-					}
-				}
-			}
+		// Print debug information if flaged.
+		if (DEBUG && (iteration % 100) == 0)
+		{
+			printf("Iteration: %d, maximum: %f, previous (%s) maximum: %f\n", iteration, maximum,
+				(turn == EVEN) ? "even" : "odd", previousMaximum[turn]);
+		}
 
-			// Calculate the maximum sum of the elements.
-			maximum = -999999.0;
-			for(m = 1; m < SIZE + 1; m++) 
-			{
-				sum = 0.0;
+		// Prepare for next iteration.
+		previousMaximum[turn] = maximum;
+		turn = 1 - turn;
 
-				for(n = 1; n < SIZE + 1; n++)
-				{
-					sum += A[m][n];	
-				}
+		// Exit if the approximation does not converge fast enough.
+		if (iteration > MAXITERATIONS)
+		{
+			finished = 1;
+		}
+	}
 
-				if(sum > maximum)	
-				{
-					maximum = sum;
-				}
-			}
+	return iteration;
+}
 
-			// Check wether the approximation is finished or not, by comparing the odd sum with the previous sum.
-			if(fabs(maximum - previousMaximum_ODD) <= DIFFERANCELIMIT)
-			{
-				finished = 1;
-			}
+// Update all elements of one color, stored in x, from the other color,
+// stored in y. Row m of each color holds the elements n = 2k + s of that
+// color, compacted. The neighbours above and below have the same k in y,
+// the ones to the left and right are k - 1 + s and k + s.
+static void SweepSplit(double *x, const double *y, int color, int W, double w)
+{
+	int m;
 
-			// Print debug information if flaged.
-			if(DEBUG && (iteration%100) == 0)
-			{
-				printf("Iteration: %d, maximum: %f, previous (odd) maximum: %f\n", iteration, maximum, previousMaximum_ODD);
-			}
+	for (m = 1; m < size + 1; m++)
+	{
+		int s = (m + color) % 2;
 
-			// Prepare for next iteration.
-			previousMaximum_ODD = maximum;
-			turn = EVEN;
-		} 
+		grid_sor_row_split(&x[m * W], &y[(m - 1) * W], &y[(m + 1) * W], &y[m * W], (s == 0) ? 1 : 0, (size - s) / 2,
+			s, w, NULL, NULL);
+	}
+}
 
-		// Exit if the approximation does not converge fast enough.
-		if(iteration > 100000) 
-		{
-			printf("[FAILURE] Maximum number of iterations reached before convergance.\n");
-			printf("Change parameters and try again...\n");
-			finished = 1;
-		}
-    }
+// Sum of the elements of row m that belong to color, without the border.
+static double RowSumSplit(const double *x, int m, int color, int W)
+{
+	int s = (m + color) % 2;
 
-    return iteration;
+	return grid_row_sum(&x[m * W], (s == 0) ? 1 : 0, (size - s) / 2);
 }
 
-int MasterBlockedApproximation(int nodes)
+// Same approximation as SequentialApproximation(), with the red (EVEN) and
+// black (ODD) elements in separate arrays. Every half sweep is then a unit
+// stride loop without branches. A is only used to convert to and from the
+// natural layout.
+int SplitApproximation()
 {
-	if (nodes == 2)
+	double previousMaximum[2] = { 0.0, 0.0 };
+	double maximum = 0.0;
+	double sum = 0.0;
+	double w = relaxation;
+
+	int m, n;
+	int turn = EVEN;
+	int iteration = 0;
+	int finished = 0;
+	int W = (sizeWithBorders + 1) / 2;
+	double *colors[2];
+
+	colors[EVEN] = grid_alloc(sizeWithBorders, W, NULL);
+	colors[ODD] = grid_alloc(sizeWithBorders, W, NULL);
+
+	// Element (m, n) is element n / 2 of row m of its color.
+	for (m = 0; m < sizeWithBorders; m++)
 	{
-		// Dont know if this needs to be done?
+		for (n = 0; n < sizeWithBorders; n++)
+		{
+			colors[(m + n) % 2][m * W + n / 2] = A[m * sizeWithBorders + n];
+		}
 	}
 
-	if (nodes == 4)
+	// Approximate until finished.
+	while (!finished)
 	{
-		// Create 4 blocks and fill them
-		// The blocks will be one quarter of the original block with an extra border in x and y for data exchange 
-		int blocksize = (SIZEWITHBORDERS / 2) + 1;
-		int blocksizeSquared = blocksize * blocksize;
-		int* myBlock;
-		int i, j;
+		iteration++;
 
-		// Block (1,1) for node 1
-		myBlock = malloc(sizeof(int)* blocksizeSquared);
-		for (i = 0; i < blocksize; i++)
+		SweepSplit(colors[turn], colors[1 - turn], turn, W, w);
+
+		// Calculate the maximum sum of the elements.
+		maximum = -999999.0;
+		for (m = 1; m < size + 1; m++)
 		{
-			for (j = 0; j < blocksize; j++)
+			sum = RowSumSplit(colors[EVEN], m, EVEN, W) + RowSumSplit(colors[ODD], m, ODD, W);
+
+			if (sum > maximum)
 			{
-				myBlock[i * blocksize + j] = A[i][j];
+				maximum = sum;
 			}
 		}
-		MPI_Send(block12, blocksizeSquared, MPI_INT, 1, 0, MPI_COMM_WORLD);
 
-		// Block (1,2) for node 2
-		for (i = 0; i < blocksize; i++)
+		// Check wether the approximation is finished or not, by comparing with the previous sum of this color.
+		if (fabs(maximum - previousMaximum[turn]) <= differenceLimit)
 		{
-			// No need to realloc memory since same size is used
-			for (j = 0; j < blocksize; j++)
-			{
-				myBlock[i * blocksize + j] = A[i][j + blocksize - 1];
-			}
+			finished = 1;
 		}
-		MPI_Send(block12, blocksizeSquared, MPI_INT, 2, 0, MPI_COMM_WORLD);
 
-		// Block (2,1) for node 3
-		for (i = 0; i < blocksize; i++)
+		// Print debug information if flaged.
+		if (DEBUG && (iteration % 100) == 0)
 		{
-			for (j = 0; j < blocksize; j++)
-			{
-				myBlock[i * blocksize + j] = A[i + blocksize - 1][j];
-			}
+			printf("Iteration: %d, maximum: %f, previous (%s) maximum: %f\n", iteration, maximum,
+				(turn == EVEN) ? "even" : "odd", previousMaximum[turn]);
 		}
-		MPI_Send(block12, blocksizeSquared, MPI_INT, 3, 0, MPI_COMM_WORLD);
 
-		// Block (2,2) for self/master
-		for (i = 0; i < blocksize; i++)
+		// Prepare for next iteration.
+		previousMaximum[turn] = maximum;
+		turn = 1 - turn;
+
+		// Exit if the approximation does not converge fast enough.
+		if (iteration > MAXITERATIONS)
 		{
-			for (j = 0; j < blocksize; j++)
-			{
-				myBlock[i * blocksize + j] = A[i + blocksize - 1][j + blocksize - 1];
-			}
+			finished = 1;
 		}
+	}
 
-		// Start the timer.
-		startTime = MPI_Wtime();
+	// Back to the natural layout.
+	for (m = 0; m < sizeWithBorders; m++)
+	{
+		for (n = 0; n < sizeWithBorders; n++)
+		{
+			A[m * sizeWithBorders + n] = colors[(m + n) % 2][m * W + n / 2];
+		}
+	}
+
+	free(colors[EVEN]);
+	free(colors[ODD]);
+	return iteration;
+}
+
+// Split n elements over parts, the first (n % parts) parts get one extra.
+static void SplitRange(int n, int parts, int index, int *count, int *offset)
+{
+	int base = n / parts;
+	int extra = n % parts;
+
+	*count = base + (index < extra ? 1 : 0);
+	*offset = index * base + (index < extra ? index : extra);
+}
 
-		// Start calculating.
+// Rank of the node dRow rows and dCol columns away in the grid, or
+// MPI_PROC_NULL outside of it.
+static int Neighbour(int dRow, int dCol)
+{
+	int coords[2] = { myRow + dRow, myCol + dCol };
+	int rank = MPI_PROC_NULL;
 
+	if (coords[0] >= 0 && coords[0] < gridRows && coords[1] >= 0 && coords[1] < gridCols)
+	{
+		MPI_Cart_rank(gridComm, coords, &rank);
 	}
+
+	return rank;
 }
 
-void WorkerBlockedApproximation()
+// Arrange all nodes in a 2D grid and find this node's block and neighbours.
+void SetupGrid()
 {
-	if (processorRank == 0)
+	int dims[2] = { 0, 0 };
+	int periods[2] = { 0, 0 };
+	int coords[2];
+	int keepCols[2] = { 0, 1 };
+	int smallest;
+
+	MPI_Dims_create(processorsAvailable, 2, dims);
+
+	// Every node needs at least one row and one column of the matrix. The
+	// grid from MPI_Dims_create is the most square one, any other grid of
+	// these nodes is longer, so if it does not fit none does.
+	if (dims[0] > size || dims[1] > size)
 	{
-		printf("[ERROR] WorkerBlockedApproximation called on master node.");
+		if (processorRank == 0)
+		{
+			printf("[ERROR] %d nodes need a %d x %d grid, but the matrix has only %d rows/columns.\n",
+				processorsAvailable, dims[0], dims[1], size);
+			printf("Use fewer nodes or a larger -n.\n");
+		}
+		MPI_Finalize();
 		exit(1);
 	}
+	MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &gridComm);
+	MPI_Cart_coords(gridComm, processorRank, 2, coords);
+	MPI_Cart_sub(gridComm, keepCols, &rowComm);
+
+	gridRows = dims[0];
+	gridCols = dims[1];
+	myRow = coords[0];
+	myCol = coords[1];
+
+	MPI_Cart_shift(gridComm, 0, 1, &north, &south);
+	MPI_Cart_shift(gridComm, 1, 1, &west, &east);
+	northWest = Neighbour(-1, -1);
+	northEast = Neighbour(-1, 1);
+	southWest = Neighbour(1, -1);
+	southEast = Neighbour(1, 1);
+
+	SplitRange(size, gridRows, myRow, &blockRows, &rowOffset);
+	SplitRange(size, gridCols, myCol, &blockCols, &colOffset);
+
+	// The ghost zone is filled from the adjacent blocks only, so it can not
+	// be wider than the smallest block, and it needs at least one row and
+	// column of it.
+	smallest = (size / gridRows < size / gridCols) ? size / gridRows : size / gridCols;
+	if (smallest < 1)
+	{
+		if (processorRank == 0)
+		{
+			printf("[ERROR] The smallest block is empty, too small for a ghost width of %d.\n", ghostWidth);
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	if (ghostWidth > smallest)
+	{
+		ghostWidth = smallest;
+		if (processorRank == 0)
+		{
+			printf("Ghost width reduced to %d, the size of the smallest block.\n", ghostWidth);
+		}
+	}
+	block = grid_alloc(blockRows + 2 * ghostWidth, blockCols + 2 * ghostWidth, &blockWidth);
+	rowSums = malloc(sizeof(double) * blockRows);
+	previousSums[EVEN] = calloc(blockRows, sizeof(double));
+	previousSums[ODD] = calloc(blockRows, sizeof(double));
+	stageOneSums = malloc(sizeof(double) * 2 * blockRows);
+
+	// ghostWidth rows, ghostWidth columns, and a corner of the block.
+	MPI_Type_vector(ghostWidth, blockCols, blockWidth, MPI_DOUBLE, &rowsType);
+	MPI_Type_vector(blockRows, ghostWidth, blockWidth, MPI_DOUBLE, &columnsType);
+	MPI_Type_vector(ghostWidth, ghostWidth, blockWidth, MPI_DOUBLE, &cornerType);
+	MPI_Type_commit(&rowsType);
+	MPI_Type_commit(&columnsType);
+	MPI_Type_commit(&cornerType);
+
+	haloCount = SetupHalo(block, haloRequests);
+	haloBytes = sizeof(double) * ((long)ghostWidth * blockCols * ((north != MPI_PROC_NULL) + (south != MPI_PROC_NULL))
+		+ (long)blockRows * ghostWidth * ((west != MPI_PROC_NULL) + (east != MPI_PROC_NULL)));
+	if (ghostWidth > 1)
+	{
+		haloBytes += sizeof(double) * ghostWidth * ghostWidth * ((northWest != MPI_PROC_NULL) + (northEast != MPI_PROC_NULL)
+			+ (southWest != MPI_PROC_NULL) + (southEast != MPI_PROC_NULL));
+	}
+}
 
-	int** myBlock;
+// Fill this node's block, including the ghost rows/columns. The rows are
+// split over the threads as in the sweep, so each thread touches the
+// memory it works on first.
+void InitializeBlock()
+{
+	int m, n;
 
-	// Work for the 1 remaining node.
-	if(processorsUsed == 2)
+	#pragma omp parallel for private(n) schedule(static)
+	for (m = 0; m < blockRows + 2 * ghostWidth; m++)
 	{
-		int blockSizeX = (SIZEWITHBORDERS / 2) + 1;
-		int blockSizeY = SIZEWITHBORDERS + 1;
+		for (n = 0; n < blockCols + 2 * ghostWidth; n++)
+		{
+			block[m * blockWidth + n] = InitialValue(rowOffset + m + 1 - ghostWidth, colOffset + n + 1 - ghostWidth);
+		}
+	}
+}
 
-		// Receive initial block
-		MPI_Recv(&myBlock, blockSizeX * blockSizeY, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
+// Set up the halo exchange of field, which has the layout of the block,
+// and return the number of requests. The outermost ghostWidth rows/columns
+// of the block are sent to the adjacent blocks, and their edges are received
+// into the ghost rows/columns. Everything is sent and received in place
+// with strided datatypes, so no buffers are needed. At the border of the
+// matrix the neighbour is MPI_PROC_NULL, which leaves the fixed border
+// values untouched. With a single ghost row/column the corners are never
+// read, wider ghost zones also get the corners from the diagonal neighbours.
+int SetupHalo(double *field, MPI_Request *requests)
+{
+	int g = ghostWidth;
+	double *first = &field[g * blockWidth + g];
+
+	// First rows north, last rows south, and the ghost rows from both.
+	MPI_Send_init(first, 1, rowsType, north, 0, gridComm, &requests[0]);
+	MPI_Recv_init(first + blockRows * blockWidth, 1, rowsType, south, 0, gridComm, &requests[1]);
+	MPI_Send_init(first + (blockRows - g) * blockWidth, 1, rowsType, south, 1, gridComm, &requests[2]);
+	MPI_Recv_init(first - g * blockWidth, 1, rowsType, north, 1, gridComm, &requests[3]);
+
+	// First columns west, last columns east, and the ghost columns from both.
+	MPI_Send_init(first, 1, columnsType, west, 2, gridComm, &requests[4]);
+	MPI_Recv_init(first + blockCols, 1, columnsType, east, 2, gridComm, &requests[5]);
+	MPI_Send_init(first + blockCols - g, 1, columnsType, east, 3, gridComm, &requests[6]);
+	MPI_Recv_init(first - g, 1, columnsType, west, 3, gridComm, &requests[7]);
+
+	if (g > 1)
+	{
+		// The corners of the block to the diagonal neighbours, and theirs into the ghost corners.
+		MPI_Send_init(first, 1, cornerType, northWest, 5, gridComm, &requests[8]);
+		MPI_Recv_init(first + blockRows * blockWidth + blockCols, 1, cornerType, southEast, 5, gridComm, &requests[9]);
+		MPI_Send_init(first + blockCols - g, 1, cornerType, northEast, 6, gridComm, &requests[10]);
+		MPI_Recv_init(first + blockRows * blockWidth - g, 1, cornerType, southWest, 6, gridComm, &requests[11]);
+		MPI_Send_init(first + (blockRows - g) * blockWidth, 1, cornerType, southWest, 7, gridComm, &requests[12]);
+		MPI_Recv_init(first - g * blockWidth + blockCols, 1, cornerType, northEast, 7, gridComm, &requests[13]);
+		MPI_Send_init(first + (blockRows - g) * blockWidth + blockCols - g, 1, cornerType, southEast, 8, gridComm, &requests[14]);
+		MPI_Recv_init(first - g * blockWidth - g, 1, cornerType, northWest, 8, gridComm, &requests[15]);
+		return 16;
+	}
 
-		// Perform LaPlace approximation.
-		//LaplaceOverBlock(myBlock, blockSizeX, blockSizeY); DOES NOT WORK, LaplaceOverBlock() written for rectangular blocks.
+	return 8;
+}
+
+// Sums of the rows of this node's block, without the ghost columns.
+// Called by all threads of the team, each one sums its share of the rows.
+void PartialRowSums(double *sums)
+{
+	int m;
+
+	#pragma omp for schedule(static)
+	for (m = ghostWidth; m < blockRows + ghostWidth; m++)
+	{
+		sums[m - ghostWidth] = grid_row_sum(&block[m * blockWidth], ghostWidth, blockCols + ghostWidth - 1);
 	}
+}
+
+// Calculate the elements of one color inside rows firstRow..lastRow and
+// columns firstCol..lastCol of the block. The color is decided by the
+// position in the full matrix, the ghost offsets on both sides cancel out.
+void SweepRectangle(int firstRow, int lastRow, int firstCol, int lastCol, int color, double w)
+{
+	int m;
+	int W = blockWidth;
 
-	// Work for 3 nodes.
-	else if(processorsUsed == 4)
+	for (m = firstRow; m <= lastRow; m++)
 	{
-		int blockSize = (SIZEWITHBORDERS / 2) + 1;
+		// The first column of this color in row m is firstCol or the next one.
+		int first = firstCol + (rowOffset + m + colOffset + firstCol + color) % 2;
 
-		// Receive initial block
-		MPI_Recv(&myBlock, blockSize * blockSize, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
+		grid_sor_row(&block[m * W], &block[(m - 1) * W], &block[(m + 1) * W], first, lastCol, w, NULL, NULL);
+	}
+}
+
+// Largest of the first count sums.
+static double Maximum(const double *sums, int count)
+{
+	double maximum = -999999.0;
+	int m;
 
-		// Perform LaPlace approximation.
-		LaplaceOverBlock(myBlock, blockSize);
+	for (m = 0; m < count; m++)
+	{
+		if (sums[m] > maximum)
+		{
+			maximum = sums[m];
+		}
 	}
+
+	return maximum;
 }
 
-void LaplaceOverBlock(int* block, int blocksize)
+// The maximum row sum of the full matrix needs two reductions: the partial
+// sums of each row are added up along the grid row, then the maximum is
+// taken over all nodes. Both are nonblocking and each one runs alongside
+// one sweep, so a check started after sweep i is decided after sweep i + 2.
+// Every check reduces the row sums of sweep i and of sweep i - 2, the same
+// two maximums the sequential version compares.
+//
+// The halo is exchanged every ghostWidth sweeps. The first sweep after an
+// exchange also updates ghostWidth - 1 rows/columns of ghost cells around
+// the block, the next one ghostWidth - 2, and so on, computing the same
+// values as the adjacent blocks. The last one only updates the block and
+// starts the next exchange.
+//
+// The whole loop runs in one thread team. The inner part of the block does
+// not depend on the ghost rows/columns and is not being sent, so all
+// threads update it while the halo is still on its way. Then the master
+// thread completes the exchange, the team updates the rest, and the master
+// starts the next exchange. It alone makes the MPI calls.
+int LaplaceOverBlock()
 {
-	double previousMaximum_EVEN = 0.0;
-	double previousMaximum_ODD = 0.0;
-	double maximum = 0.0;
-	double sum = 0.0;
-	double w = 0.5;
+	MPI_Request stageOne = MPI_REQUEST_NULL;
+	MPI_Request stageTwo = MPI_REQUEST_NULL;
+	double localMaxima[2];
+	double maxima[2];
+	double *swap;
+	double w = relaxation;
 
-	int	m, n, i;
-	int turn = EVEN;
-	int iteration = 0;
+	int iterations = 0;
 	int finished = 0;
+	int haloActive = 0;
+	int stageOneIteration = 0;
+	int stageTwoIteration = 0;
+	long reduceBytes;
 
-	// Approximate until finished.
-	while (!finished)
+	#pragma omp parallel
 	{
-		iteration++;
+		// Every thread counts the sweeps and colors itself, only finished is
+		// shared, it is set by the master between two barriers.
+		int m;
+		int g = ghostWidth;
+		int turn = EVEN;
+		int iteration = 0;
+		int needSums;
+		int extra;
+		int firstRow, lastRow, firstCol, lastCol;
+		int innerFirstRow, innerLastRow, innerFirstCol, innerLastCol;
+
+		// Away from the ghosts, and from the rows/columns that are sent.
+		innerFirstRow = 2 * g;
+		innerLastRow = blockRows - 1;
+		innerFirstCol = 2 * g;
+		innerLastCol = blockCols - 1;
+		if (innerFirstCol > innerLastCol)
+		{
+			innerLastRow = innerFirstRow - 1;
+		}
 
-		// Calculate even elements.
-		if (turn == EVEN)
+		// Approximate until finished.
+		while (!finished)
 		{
-			for (m = 1; m < blocksize - 1; m++)
+			iteration++;
+
+			// The block and the ghost cells this sweep updates, as far as they are inside the matrix.
+			extra = g - 1 - (iteration - 1) % g;
+			firstRow = (g - extra > g - rowOffset) ? g - extra : g - rowOffset;
+			lastRow = (g + blockRows - 1 + extra < g + size - rowOffset - 1) ? g + blockRows - 1 + extra : g + size - rowOffset - 1;
+			firstCol = (g - extra > g - colOffset) ? g - extra : g - colOffset;
+			lastCol = (g + blockCols - 1 + extra < g + size - colOffset - 1) ? g + blockCols - 1 + extra : g + size - colOffset - 1;
+
+			// Calculate the elements of this color in the inner part of the block.
+			#pragma omp master
+			timing_begin(PHASE_COMPUTE);
+			#pragma omp for schedule(static) nowait
+			for (m = innerFirstRow; m <= innerLastRow; m++)
 			{
-				for (n = 1; n < blocksize - 1; n++)
+				SweepRectangle(m, m, innerFirstCol, innerLastCol, turn, w);
+			}
+
+			// The halo is needed for the rest.
+			#pragma omp master
+			{
+				timing_end(PHASE_COMPUTE, 0);
+				if (haloActive)
 				{
-					if (((m + n) % 2) == 0)
-					{
-						// Perform average operation, using the elements 4 neighbours.
-						block[m * blocksize + n] = (1 - w) * block[m * blocksize + n] + w * (block[(m - 1) * blocksize + n] + block[(m + 1)* blocksize + n] + block[m * blocksize + n - 1] + block[m * blocksize + n + 1]) / 4;
-					}
+					timing_begin(PHASE_HALO_WAIT);
+					MPI_Waitall(haloCount, haloRequests, MPI_STATUSES_IGNORE);
+					timing_end(PHASE_HALO_WAIT, 0);
+					haloActive = 0;
 				}
+				timing_begin(PHASE_COMPUTE);
 			}
+			#pragma omp barrier
 
-			// Calculate the maximum sum of the elements.
-			maximum = -999999.0;
-			for (m = 1; m < blocksize - 1; m++)
+			// Everything around the inner part.
+			#pragma omp for schedule(static)
+			for (m = firstRow; m <= lastRow; m++)
 			{
-				sum = 0.0;
-
-				for (n = 1; n < blocksize - 1; n++)
+				if (m >= innerFirstRow && m <= innerLastRow)
 				{
-					sum += block[m * blocksize + n];
+					SweepRectangle(m, m, firstCol, innerFirstCol - 1, turn, w);
+					SweepRectangle(m, m, innerLastCol + 1, lastCol, turn, w);
 				}
-
-				if (sum > maximum)
+				else
 				{
-					maximum = sum;
+					SweepRectangle(m, m, firstCol, lastCol, turn, w);
 				}
 			}
 
-			// Check wether the approximation is finished or not, by comparing the even sum with the previous sum.
-			if (fabs(maximum - previousMaximum_EVEN) <= DIFFERANCELIMIT)
+			// Send the outermost rows/columns to the adjacent blocks.
+			#pragma omp master
 			{
-				finished = 1;
+				timing_end(PHASE_COMPUTE, 0);
+				if (iteration % g == 0)
+				{
+					timing_begin(PHASE_HALO_START);
+					MPI_Startall(haloCount, haloRequests);
+					timing_end(PHASE_HALO_START, haloBytes);
+					haloActive = 1;
+				}
 			}
 
-			// Print debug information if flaged.
-			if (DEBUG && (iteration % 100) == 0)
+			// Row sums are needed when this sweep is checked, and when the
+			// sweep two later is checked, since it compares with this one.
+			needSums = (iteration % checkInterval == 0 || (iteration + 2) % checkInterval == 0);
+			if (needSums)
 			{
-				printf("Iteration: %d, maximum: %f, previous (even) maximum: %f\n", iteration, maximum, previousMaximum_EVEN);
+				#pragma omp master
+				timing_begin(PHASE_ROW_SUMS);
+				PartialRowSums(rowSums);
 			}
 
-			// Prepare for next iteration.
-			previousMaximum_EVEN = maximum;
-			turn = ODD;
-		}
-
-		// Calculate odd elements.
-		else if (turn == ODD)
-		{
-			for (m = 1; m < blocksize - 1; m++)
+			#pragma omp master
 			{
-				for (n = 1; n < blocksize - 1; n++)
+				if (needSums)
 				{
-					if (((m + n) % 2) == 1)
+					timing_end(PHASE_ROW_SUMS, 0);
+				}
+				timing_begin(PHASE_REDUCE);
+				reduceBytes = 0;
+
+				// The check started two sweeps ago is done, the result is the same on all nodes.
+				if (stageTwo != MPI_REQUEST_NULL)
+				{
+					MPI_Wait(&stageTwo, MPI_STATUS_IGNORE);
+
+					// Check wether the approximation is finished or not, by comparing with the previous sum of this color.
+					if (fabs(maxima[0] - maxima[1]) <= differenceLimit)
 					{
-						// Perform average operation, using the elements 4 neighbours.
-						block[m * blocksize + n] = (1 - w) * block[m * blocksize + n] + w * (block[(m - 1) * blocksize + n] + block[(m + 1) * blocksize + n] + block[m * blocksize + n - 1] + block[m * blocksize + n + 1]) / 4;
+						finished = 1;
+					}
+
+					// Print debug information if flaged.
+					if (DEBUG && processorRank == 0 && (stageTwoIteration % 100) == 0)
+					{
+						printf("Iteration: %d, maximum: %f, previous (%s) maximum: %f\n", stageTwoIteration, maxima[0],
+							(stageTwoIteration % 2 == 1) ? "even" : "odd", maxima[1]);
 					}
 				}
-			}
 
-			// Calculate the maximum sum of the elements.
-			maximum = -999999.0;
-			for (m = 1; m < blocksize - 1; m++)
-			{
-				sum = 0.0;
+				// The row sums of the check started one sweep ago are complete,
+				// start taking the maximum over all nodes.
+				if (stageOne != MPI_REQUEST_NULL)
+				{
+					MPI_Wait(&stageOne, MPI_STATUS_IGNORE);
+
+					localMaxima[0] = Maximum(stageOneSums, blockRows);
+					localMaxima[1] = Maximum(stageOneSums + blockRows, blockRows);
+					MPI_Iallreduce(localMaxima, maxima, 2, MPI_DOUBLE, MPI_MAX, gridComm, &stageTwo);
+					reduceBytes += sizeof(localMaxima);
+					stageTwoIteration = stageOneIteration;
+				}
 
-				for (n = 1; n < blocksize - 1; n++)
+				if (!finished && needSums)
 				{
-					sum += block[m * blocksize + n];
+					if (iteration % checkInterval == 0)
+					{
+						memcpy(stageOneSums, rowSums, sizeof(double) * blockRows);
+						memcpy(stageOneSums + blockRows, previousSums[turn], sizeof(double) * blockRows);
+						MPI_Iallreduce(MPI_IN_PLACE, stageOneSums, 2 * blockRows, MPI_DOUBLE, MPI_SUM, rowComm, &stageOne);
+						reduceBytes += sizeof(double) * 2 * blockRows;
+						stageOneIteration = iteration;
+					}
+
+					swap = previousSums[turn];
+					previousSums[turn] = rowSums;
+					rowSums = swap;
 				}
 
-				if (sum > maximum)
+				timing_end(PHASE_REDUCE, reduceBytes);
+
+				// Exit if the approximation does not converge fast enough.
+				if (iteration > MAXITERATIONS)
 				{
-					maximum = sum;
+					finished = 1;
 				}
-			}
 
-			// Check wether the approximation is finished or not, by comparing the odd sum with the previous sum.
-			if (fabs(maximum - previousMaximum_ODD) <= DIFFERANCELIMIT)
-			{
-				finished = 1;
+				iterations = iteration;
 			}
 
-			// Print debug information if flaged.
-			if (DEBUG && (iteration % 100) == 0)
-			{
-				printf("Iteration: %d, maximum: %f, previous (odd) maximum: %f\n", iteration, maximum, previousMaximum_ODD);
-			}
+			// Everyone sees finished and the swapped row sums before the next sweep.
+			#pragma omp barrier
 
 			// Prepare for next iteration.
-			previousMaximum_ODD = maximum;
-			turn = EVEN;
+			turn = (turn == EVEN) ? ODD : EVEN;
 		}
+	}
 
-		// Exit if the approximation does not converge fast enough.
-		if (iteration > 100000)
+	// The last halo exchange and the checks still in flight, started on every node alike.
+	if (haloActive)
+	{
+		MPI_Waitall(haloCount, haloRequests, MPI_STATUSES_IGNORE);
+	}
+	MPI_Wait(&stageOne, MPI_STATUS_IGNORE);
+	MPI_Wait(&stageTwo, MPI_STATUS_IGNORE);
+
+	return iterations;
+}
+
+// Preconditioned conjugate gradients on the same problem. The fixed point
+// of the sweeps solves A x = b for the interior of the matrix, with
+// (A x)[i][j] = 4 x[i][j] - x[i - 1][j] - x[i + 1][j] - x[i][j - 1] - x[i][j + 1]
+// and b the border elements next to (i, j). Vectors have the layout of the
+// block; only the interior is used, apart from the ghosts of the one that A
+// is applied to. They are zero at the border of the matrix, where the
+// neighbour is MPI_PROC_NULL.
+//
+// The order of operations is that of Chronopoulos and Gear: A is applied
+// to the preconditioned residual u right after it is computed, so all three
+// dot products of an iteration, (r, u), (A u, u) and (r, r), are reduced in
+// a single MPI_Allreduce. u is exchanged with the same persistent halo
+// requests as the block. Stops when the 2-norm of the residual is at most
+// the difference limit.
+
+// Sum of x * y over the interior of the block.
+static double Dot(const double *x, const double *y)
+{
+	double sum = 0.0;
+	int m, n;
+
+	#pragma omp parallel for private(n) reduction(+:sum) schedule(static)
+	for (m = ghostWidth; m < blockRows + ghostWidth; m++)
+	{
+		for (n = ghostWidth; n < blockCols + ghostWidth; n++)
 		{
-			printf("[FAILURE] Maximum number of iterations reached before convergance.\n");
-			printf("Change parameters and try again...\n");
-			finished = 1;
+			sum += x[m * blockWidth + n] * y[m * blockWidth + n];
 		}
+	}
+
+	return sum;
+}
 
-		// Sendreceive 
-		switch (processorrank)
+// q = A p for the interior of the block, the ghosts of p have to be current.
+static void ApplyLaplacian(double *q, const double *p)
+{
+	int m, n;
+	int W = blockWidth;
+
+	#pragma omp parallel for private(n) schedule(static)
+	for (m = ghostWidth; m < blockRows + ghostWidth; m++)
+	{
+		for (n = ghostWidth; n < blockCols + ghostWidth; n++)
 		{
-			int* sendbuff;
-			int* receivebuff;
+			q[m * W + n] = 4 * p[m * W + n] - p[(m - 1) * W + n] - p[(m + 1) * W + n] - p[m * W + n - 1] - p[m * W + n + 1];
+		}
+	}
+}
+
+// z = M^-1 r. Jacobi divides by the diagonal. SSOR does a forward and a
+// backward Gauss-Seidel sweep over the block, leaving out the elements of
+// the other blocks, so M stays symmetric and needs no communication. With
+// threads the block is cut the same way into one strip of rows per thread,
+// so the sweeps run in parallel; M then depends on the number of threads,
+// and so does the number of iterations.
+static void Precondition(double *z, const double *r)
+{
+	int m, n;
+	int g = ghostWidth;
+	int W = blockWidth;
+
+	if (strcmp(preconditioner, "ssor") == 0)
+	{
+		int strip;
 
-		case 1: // (1,1)
-			// Exchange with node 2 (1,2)
-			// Copy the send buffer from the matrix block
-			sendbuff = malloc(sizeof(int)* blocksize);
-			for (i = 0; i < blocksize; i++)
+		#pragma omp parallel for private(m, n) schedule(static)
+		for (strip = 0; strip < threads; strip++)
+		{
+			int rows, first, last;
+
+			SplitRange(blockRows, threads, strip, &rows, &first);
+			first += g;
+			last = first + rows - 1;
+
+			// (D + L) y = r, then (D + U) z = D y, within the strip.
+			for (m = first; m <= last; m++)
 			{
-				sendbuff[i] = block[(i * blocksize) + blocksize - 2];
+				for (n = g; n < blockCols + g; n++)
+				{
+					z[m * W + n] = (r[m * W + n] + (m > first ? z[(m - 1) * W + n] : 0.0) + (n > g ? z[m * W + n - 1] : 0.0)) / 4;
+				}
 			}
-			// Send and receive
-			receivebuff = malloc(sizeof(int)* blocksize);
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 2, 0, receivebuff, blocksize, MPI_INT, 2, 0, MPI_COMM_WORLD, &status);
-			
-			// Fill the received buffer into the matrix block
-			for (i = 0; i < blocksize; i++)
+			for (m = last; m >= first; m--)
 			{
-				block[(i * blocksize) + blocksize - 1] = receivebuff[i];
+				for (n = blockCols + g - 1; n >= g; n--)
+				{
+					z[m * W + n] += ((m < last ? z[(m + 1) * W + n] : 0.0) + (n < blockCols + g - 1 ? z[m * W + n + 1] : 0.0)) / 4;
+				}
 			}
-			free(sendbuff);
-			free(receivebuff);
-
-			// Echange with node 3 (2,1)
-			// Point the send buffer to the right row in the matrix block
-			sendbuff = &(block[(blocksize - 2) * blocksize]);
-			// Point the receive buffer to the right row in the matrix block
-			receivebuff = &(block[(blocksize - 1) * blocksize]);
-			// Send and receive
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 3, 0, receivebuff, blocksize, MPI_INT, 3, 0, MPI_COMM_WORLD, &status);
-
-			// Set pointers to 0, just in case.
-			sendbuff = 0;
-			receivebuff = 0;
-			break;
-		case 2: // (1,2)
-			// Exchange with node 1 (1,1)
-			// Copy the send buffer from the matrix block
-			sendbuff = malloc(sizeof(int)* blocksize);
-			for (i = 0; i < blocksize; i++)
+		}
+	}
+	else
+	{
+		#pragma omp parallel for private(n) schedule(static)
+		for (m = g; m < blockRows + g; m++)
+		{
+			for (n = g; n < blockCols + g; n++)
 			{
-				sendbuff[i] = block[(i * blocksize) + 1];
+				z[m * W + n] = r[m * W + n] / 4;
 			}
-			// Send and receive
-			receivebuff = malloc(sizeof(int)* blocksize);
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 1, 0, receivebuff, blocksize, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
+		}
+	}
+}
 
-			// Fill the received buffer into the matrix block
-			for (i = 0; i < blocksize; i++)
-			{
-				block[(i * blocksize)] = receivebuff[i];
-			}
-			free(sendbuff);
-			free(receivebuff);
-
-			// Echange with node 0 (2,2)
-			// Point the send buffer to the right row in the matrix block
-			sendbuff = &(block[(blocksize - 2) * blocksize]);
-			// Point the receive buffer to the right row in the matrix block
-			receivebuff = &(block[(blocksize - 1) * blocksize]);
-			// Send and receive
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 0, 0, receivebuff, blocksize, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
-
-			// Set pointers to 0, just in case.
-			sendbuff = 0;
-			receivebuff = 0;
+int ConjugateGradient()
+{
+	MPI_Request uRequests[HALO_REQUESTS];
+	int uCount;
+	size_t length = (size_t)(blockRows + 2 * ghostWidth) * blockWidth;
+	double *r = grid_alloc(blockRows + 2 * ghostWidth, blockWidth, NULL);
+	double *u = grid_alloc(blockRows + 2 * ghostWidth, blockWidth, NULL);
+	double *q = grid_alloc(blockRows + 2 * ghostWidth, blockWidth, NULL);
+	double *p = grid_alloc(blockRows + 2 * ghostWidth, blockWidth, NULL);
+	double *s = grid_alloc(blockRows + 2 * ghostWidth, blockWidth, NULL);
+	double local[3], global[3];
+	double gamma, gammaOld = 1.0, delta, alpha = 1.0, beta;
+	double *x = block;
+
+	int m, n;
+	int i;
+	int W = blockWidth;
+	int iteration = 0;
+
+	// Zero the vectors, ghosts included, with the rows split as in the
+	// loops below so every thread first touches the rows it works on.
+	#pragma omp parallel for private(n) schedule(static)
+	for (m = 0; m < blockRows + 2 * ghostWidth; m++)
+	{
+		for (n = 0; n < W; n++)
+		{
+			r[m * W + n] = u[m * W + n] = q[m * W + n] = p[m * W + n] = s[m * W + n] = 0.0;
+		}
+	}
+
+	uCount = SetupHalo(u, uRequests);
+
+	// r = b - A x, the ghosts of the block still hold the initial values.
+	ApplyLaplacian(r, x);
+	for (i = 0; i < (int)length; i++)
+	{
+		r[i] = -r[i];
+	}
+
+	// Approximate until finished.
+	while (1)
+	{
+		// u = M^-1 r and q = A u, then all dot products at once.
+		timing_begin(PHASE_COMPUTE);
+		Precondition(u, r);
+		timing_end(PHASE_COMPUTE, 0);
+		timing_begin(PHASE_HALO_START);
+		MPI_Startall(uCount, uRequests);
+		timing_end(PHASE_HALO_START, haloBytes);
+		timing_begin(PHASE_HALO_WAIT);
+		MPI_Waitall(uCount, uRequests, MPI_STATUSES_IGNORE);
+		timing_end(PHASE_HALO_WAIT, 0);
+		timing_begin(PHASE_COMPUTE);
+		ApplyLaplacian(q, u);
+
+		local[0] = Dot(r, u);
+		local[1] = Dot(q, u);
+		local[2] = Dot(r, r);
+		timing_end(PHASE_COMPUTE, 0);
+		timing_begin(PHASE_REDUCE);
+		MPI_Allreduce(local, global, 3, MPI_DOUBLE, MPI_SUM, gridComm);
+		timing_end(PHASE_REDUCE, sizeof(local));
+		gamma = global[0];
+		delta = global[1];
+
+		// Print debug information if flaged.
+		if (DEBUG && processorRank == 0 && (iteration % 100) == 0)
+		{
+			printf("Iteration: %d, residual: %e\n", iteration, sqrt(global[2]));
+		}
+
+		// Check wether the approximation is finished or not, the result is the same on all nodes.
+		if (sqrt(global[2]) <= differenceLimit || iteration > MAXITERATIONS)
+		{
 			break;
-		case 3: // (2,1)
-			// Exchange with node 0 (2,2)
-			// Copy the send buffer from the matrix block
-			sendbuff = malloc(sizeof(int)* blocksize);
-			for (i = 0; i < blocksize; i++)
+		}
+
+		iteration++;
+
+		// New search direction p and s = A p, then the step along it.
+		beta = (iteration == 1) ? 0.0 : gamma / gammaOld;
+		alpha = gamma / (delta - beta * gamma / alpha);
+		gammaOld = gamma;
+
+		timing_begin(PHASE_COMPUTE);
+		#pragma omp parallel for private(n) schedule(static)
+		for (m = ghostWidth; m < blockRows + ghostWidth; m++)
+		{
+			for (n = ghostWidth; n < blockCols + ghostWidth; n++)
 			{
-				sendbuff[i] = block[(i * blocksize) + blocksize - 2];
+				p[m * W + n] = u[m * W + n] + beta * p[m * W + n];
+				s[m * W + n] = q[m * W + n] + beta * s[m * W + n];
+				x[m * W + n] += alpha * p[m * W + n];
+				r[m * W + n] -= alpha * s[m * W + n];
 			}
-			// Send and receive
-			receivebuff = malloc(sizeof(int)* blocksize);
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 0, 0, receivebuff, blocksize, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
+		}
+		timing_end(PHASE_COMPUTE, 0);
+	}
+
+	if (processorRank == 0)
+	{
+		printf("Residual: %e\n", sqrt(global[2]));
+	}
+
+	for (i = 0; i < uCount; i++)
+	{
+		MPI_Request_free(&uRequests[i]);
+	}
+	free(r);
+	free(u);
+	free(q);
+	free(p);
+	free(s);
+	return iteration;
+}
 
-			// Fill the received buffer into the matrix block
-			for (i = 0; i < blocksize; i++)
+// Gather all blocks into the full matrix on the master. The border of the
+// full matrix never changes, so the master fills it in itself.
+void GatherMatrix()
+{
+	int rank, coords[2];
+	int rows, cols, rowStart, colStart;
+	int i, j;
+
+	timing_begin(PHASE_GATHER);
+	if (processorRank == 0)
+	{
+		A = grid_alloc(sizeWithBorders, sizeWithBorders, NULL);
+
+		for (i = 0; i < sizeWithBorders; i++)
+		{
+			for (j = 0; j < sizeWithBorders; j++)
 			{
-				block[(i * blocksize) + blocksize - 1] = receivebuff[i];
+				A[i * sizeWithBorders + j] = InitialValue(i, j);
 			}
-			free(sendbuff);
-			free(receivebuff);
-
-			// Echange with node 1 (1,1)
-			// Point the send buffer to the right row in the matrix block
-			sendbuff = &(block[blocksize]);
-			// Point the receive buffer to the right row in the matrix block
-			receivebuff = &(block[0]);
-			// Send and receive
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 1, 0, receivebuff, blocksize, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
-
-			// Set pointers to 0, just in case.
-			sendbuff = 0;
-			receivebuff = 0;
-			break;
-		case 0: // (2,2)
-			// Exchange with node 3 (2,1)
-			// Copy the send buffer from the matrix block
-			sendbuff = malloc(sizeof(int)* blocksize);
-			for (i = 0; i < blocksize; i++)
+		}
+
+		for (rank = 0; rank < processorsAvailable; rank++)
+		{
+			MPI_Datatype blockType;
+			int sizes[2] = { sizeWithBorders, sizeWithBorders };
+			int subsizes[2];
+			int starts[2];
+
+			MPI_Cart_coords(gridComm, rank, 2, coords);
+			SplitRange(size, gridRows, coords[0], &rows, &rowStart);
+			SplitRange(size, gridCols, coords[1], &cols, &colStart);
+
+			subsizes[0] = rows;
+			subsizes[1] = cols;
+			starts[0] = rowStart + 1;
+			starts[1] = colStart + 1;
+			MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &blockType);
+			MPI_Type_commit(&blockType);
+
+			if (rank == 0)
 			{
-				sendbuff[i] = block[(i * blocksize) + 1];
+				for (i = 0; i < blockRows; i++)
+				{
+					memcpy(&A[(rowOffset + 1 + i) * sizeWithBorders + colOffset + 1],
+						&block[(i + ghostWidth) * blockWidth + ghostWidth], sizeof(double) * blockCols);
+				}
 			}
-			// Send and receive
-			receivebuff = malloc(sizeof(int)* blocksize);
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 3, 0, receivebuff, blocksize, MPI_INT, 3, 0, MPI_COMM_WORLD, &status);
-
-			// Fill the received buffer into the matrix block
-			for (i = 0; i < blocksize; i++)
+			else
 			{
-				block[(i * blocksize)] = receivebuff[i];
+				MPI_Recv(A, 1, blockType, rank, 4, gridComm, MPI_STATUS_IGNORE);
 			}
-			free(sendbuff);
-			free(receivebuff);
-
-			// Echange with node 2 (1,2)
-			// Point the send buffer to the right row in the matrix block
-			sendbuff = &(block[blocksize]);
-			// Point the receive buffer to the right row in the matrix block
-			receivebuff = &(block[0]);
-			// Send and receive
-			MPI_Sendrecv(sendbuff, blocksize, MPI_INT, 2, 0, receivebuff, blocksize, MPI_INT, 2, 0, MPI_COMM_WORLD, &status);
-
-			// Set pointers to 0, just in case.
-			sendbuff = 0;
-			receivebuff = 0;
-			break;
-		case default:
-			break;
+
+			MPI_Type_free(&blockType);
 		}
 	}
+	else
+	{
+		MPI_Datatype interiorType;
+		int sizes[2] = { blockRows + 2 * ghostWidth, blockWidth };
+		int subsizes[2] = { blockRows, blockCols };
+		int starts[2] = { ghostWidth, ghostWidth };
+
+		MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &interiorType);
+		MPI_Type_commit(&interiorType);
+		MPI_Send(block, 1, interiorType, 0, 4, gridComm);
+		MPI_Type_free(&interiorType);
+	}
 
-	// TODO:
-	// When each block is done, it should be sent back to the master.
+	// The master receives all blocks but its own, the others send theirs.
+	timing_end(PHASE_GATHER, sizeof(double) * ((processorRank == 0) ? (long)size * size - (long)blockRows * blockCols
+		: (long)blockRows * blockCols));
+}
 
-	return iteration;
+// Counters of every node in turn. The model is that of the SOR sweeps:
+// 7 flops per update, half the elements of the block per sweep, and the
+// block read and written once per sweep. There is none for cg.
+void ReportCounters(int iterations)
+{
+	char label[32];
+	double points;
+	int rank;
+
+	if (solverRegion.threads == 0)
+	{
+		return;
+	}
+
+	points = (gridComm == MPI_COMM_NULL) ? (double)size * size : (double)blockRows * blockCols;
+	points *= iterations;
+	if (strcmp(solver, "cg") == 0)
+	{
+		points = 0.0;
+	}
+
+	snprintf(label, sizeof(label), "[node %d] ", processorRank);
+	for (rank = 0; rank < processorsAvailable; rank++)
+	{
+		if (rank == processorRank)
+		{
+			counters_report(&solverRegion, label, 3.5 * points, 2 * sizeof(double) * points);
+			fflush(stdout);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
 }
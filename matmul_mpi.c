@@ -1,64 +1,250 @@
-// Compile with: mpicc -o mm matmul_mpi.c
+// Compile with: mpicc -O3 -o mm matmul_mpi.c gemm.c timing.c counters.c -lm
+// Run with:     mpirun -np 4 mm [N | M K N] [-b nb] [-d] [-i] [-T trace.json]
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
+#include "gemm.h"
+#include "timing.h"
+#include "counters.h"
+#include "grid.h"
 
-// SIZE is a multiple of the number of nodes, 
-// Hint: use small sizes when testing, e.g., SIZE 8
+// Default size when none is given on the command line.
+// Hint: use small sizes when testing, e.g., 8
 #define SIZE 1024
-#define FROM_MASTER 1
-#define FROM_WORKER 2
 #define DEBUG 0
 
-#define MAX_PROCESSORS 4;
+// Default upper limit on the width of the panels broadcast in a SUMMA
+// step (-b). Narrower panels need less buffer space and let the
+// broadcast of the next panel overlap more of the multiplications.
+#define PANEL_WIDTH 256
+
+// c (M x N) = a (M x K) * b (K x N).
+static int M = SIZE, K = SIZE, N = SIZE;
+
+// Generate the a and b blocks on every node instead of on the master.
+// The master then never holds the full matrices, and c is not gathered.
+static int distributedInit = 0;
+
+// Upper limit on the panel width, see PANEL_WIDTH.
+static int maxPanelWidth = PANEL_WIDTH;
+
+// Per-phase timing (-i), and a trace of every phase (-T file).
+enum { PHASE_DISTRIBUTE, PHASE_BROADCAST, PHASE_WAIT, PHASE_COMPUTE, PHASE_GATHER, PHASE_REDUCE, PHASES };
+static const char *const phaseNames[PHASES] = { "distribute", "broadcast", "wait", "compute", "gather", "reduce" };
+static int timing = 0;
+static const char *traceFile = NULL;
+
+// Hardware counters around the local multiplications (KERNEL_COUNTERS=1).
+static struct counter_region gemmRegion;
+
+// Full matrices, only allocated on the master. They are padded with
+// zeros to Mp x Kp, Kp x Np and Mp x Np so every block has the same size.
+static int Mp, Kp, Np;
+static double *a, *b, *c;
+
+// Process grid, node (row, col) owns block (row, col) of a, b and c.
+static int gridRows, gridCols;
+static int myRow, myCol;
+static MPI_Comm gridComm, rowComm, colComm;
+
+// Local blocks, allocated by every node.
+static int blockRows;	// Rows in the a and c blocks.
+static int blockCols;	// Columns in the b and c blocks.
+static int aBlockCols;	// Columns in the a block.
+static int bBlockRows;	// Rows in the b block.
+static int summaSteps;	// Number of SUMMA steps, Kp / panelWidth.
+static int panelWidth;	// Width of the panels broadcast in each SUMMA step.
+static int aChunks;		// Panels in the a block, aBlockCols / panelWidth.
+static int bChunks;		// Panels in the b block, bBlockRows / panelWidth.
+
+// The a block is stored panel by panel, (blockRows x panelWidth) each, so
+// a panel can be sent and broadcast without packing. The b block is
+// stored row by row, its panels are already contiguous.
+static double *aBlock, *bBlock, *cBlock;
+
+// Two sets of panel buffers, so the broadcast of the next SUMMA step
+// can run while the current one is multiplied.
+static double *aPanel[2], *bPanel[2];
+
+// One scatter request per panel of the local a and b blocks, so a SUMMA
+// step only waits for the panels it needs.
+static MPI_Request *aChunkReq, *bChunkReq;
+
+// Datatypes describing one a panel, one b panel and one c block in place
+// in the full matrices on the master. Their extent is resized so that
+// scatter and gather displacements count whole panels/blocks.
+static MPI_Datatype aPanelType, bPanelType, cBlockType;
+
+// Allocate a zeroed, cache line aligned (rows x cols) matrix.
+static double *alloc_matrix(int rows, int cols)
+{
+	double *ptr = grid_alloc(rows, cols, NULL);
+
+	if (ptr == NULL)
+	{
+		printf("[ERROR] Could not allocate %d x %d matrix.\n", rows, cols);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
 
-MPI_Status status;
+	// The padding of the blocks has to be zero for gemm.
+	memset(ptr, 0, sizeof(double) * (size_t)rows * cols);
+	return ptr;
+}
+
+static void usage(const char *prog)
+{
+	printf("\nUsage: %s [N]            N x N times N x N\n", prog);
+	printf("       %s [M K N]        M x K times K x N\n", prog);
+	printf("           [-b nb] panel width limit, default %d\n", PANEL_WIDTH);
+	printf("           [-d] generate blocks on every node, do not gather c\n");
+	printf("           [-i] time the phases on every node\n");
+	printf("           [-T file] -i, and write a Chrome trace of the phases\n");
+	printf("           [-h] help \n\n");
+}
 
-static double a[SIZE][SIZE];
-static double b[SIZE][SIZE];
-static double c[SIZE][SIZE];
+static void read_options(int argc, char **argv, int myrank)
+{
+	int sizes[3];
+	int count = 0;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+			case 'b':
+				if (i + 1 < argc)
+				{
+					maxPanelWidth = atoi(argv[++i]);
+				}
+				break;
+			case 'd':
+				distributedInit = 1;
+				break;
+			case 'i':
+				timing = 1;
+				break;
+			case 'T':
+				if (i + 1 < argc)
+				{
+					timing = 1;
+					traceFile = argv[++i];
+				}
+				break;
+			case 'h':
+			case 'u':
+				if (myrank == 0)
+				{
+					usage(argv[0]);
+				}
+				MPI_Finalize();
+				exit(0);
+			default:
+				if (myrank == 0)
+				{
+					printf("%s: ignored option: %s\n", argv[0], argv[i]);
+				}
+				break;
+			}
+		}
+		else if (count < 3)
+		{
+			sizes[count++] = atoi(argv[i]);
+		}
+	}
 
-static double a1[SIZE / 2][SIZE];
-static double a2[SIZE / 2][SIZE];
+	if (count == 1)
+	{
+		M = K = N = sizes[0];
+	}
+	else if (count == 3)
+	{
+		M = sizes[0];
+		K = sizes[1];
+		N = sizes[2];
+	}
+	else if (count != 0)
+	{
+		if (myrank == 0)
+		{
+			usage(argv[0]);
+		}
+		MPI_Finalize();
+		exit(1);
+	}
 
-static double b1[SIZE][SIZE / 2];
-static double b2[SIZE][SIZE / 2];
+	if (M <= 0 || K <= 0 || N <= 0)
+	{
+		if (myrank == 0)
+		{
+			printf("[ERROR] Matrix sizes have to be positive.\n");
+		}
+		MPI_Finalize();
+		exit(1);
+	}
 
-static double cHalf[SIZE / 2][SIZE];
-static double cQuarter[SIZE / 2][SIZE / 2];
+	if (maxPanelWidth <= 0)
+	{
+		if (myrank == 0)
+		{
+			printf("[ERROR] The panel width has to be positive.\n");
+		}
+		MPI_Finalize();
+		exit(1);
+	}
+}
 
-// Initialize a matrix of size (SIZE * SIZE).
-// For simplicity, all values will be set to 1.0.
+// Initialize the full matrices on the master, a[i][k] = i + k and
+// b[k][j] = k + j, so every element of c is different and the result
+// can be checked against a closed form (see check_result()).
 static void init_matrix(void)
 {
 	int x, y;
-    for (x = 0; x < SIZE; x++)
+
+	a = alloc_matrix(Mp, Kp);
+	b = alloc_matrix(Kp, Np);
+	c = alloc_matrix(Mp, Np);
+
+	for (x = 0; x < M; x++)
 	{
-        for (y = 0; y < SIZE; y++) 
+		for (y = 0; y < K; y++)
 		{
-			a[x][y] = 1.0;
-			b[x][y] = 1.0;
+			a[(size_t)x * Kp + y] = x + y;
+		}
+	}
+	for (x = 0; x < K; x++)
+	{
+		for (y = 0; y < N; y++)
+		{
+			b[(size_t)x * Np + y] = x + y;
+		}
+	}
+}
 
-			// a block-matrix
-			if (x < SIZE / 2)
-			{
-				a1[x][y] = 1.0;	
-			}
-			else
-			{
-				a2[x - (SIZE / 2)][y] = 1.0;
-			}
+// Initialize the local a and b blocks straight on every node,
+// with the same values init_matrix() would give them.
+static void init_blocks(void)
+{
+	int rowA = myRow * blockRows, colA = myCol * aBlockCols;
+	int rowB = myRow * bBlockRows, colB = myCol * blockCols;
+	int x, y;
 
-			// b block-matrix
-			if (y < SIZE / 2)
-			{
-				b1[x][y] = 1.0;
-			}
-			else
-			{
-				b2[x][y - (SIZE / 2)] = 1.0;
-			}
+	for (x = 0; x < blockRows && rowA + x < M; x++)
+	{
+		for (y = 0; y < aBlockCols && colA + y < K; y++)
+		{
+			aBlock[((size_t)(y / panelWidth) * blockRows + x) * panelWidth + y % panelWidth] = rowA + x + colA + y;
+		}
+	}
+	for (x = 0; x < bBlockRows && rowB + x < K; x++)
+	{
+		for (y = 0; y < blockCols && colB + y < N; y++)
+		{
+			bBlock[(size_t)x * blockCols + y] = rowB + x + colB + y;
 		}
 	}
 }
@@ -67,338 +253,434 @@ static void init_matrix(void)
 static void print_matrix(void)
 {
 	int x, y;
-    for (x = 0; x < SIZE; x++) 
+	for (x = 0; x < M; x++)
 	{
-        for (y = 0; y < SIZE; y++)
+		for (y = 0; y < N; y++)
 		{
-			printf(" %7.2f", c[x][y]);
+			printf(" %7.2f", c[(size_t)x * Np + y]);
 		}
 
 		printf("\n");
-    }
+	}
 }
 
-int main(int argc, char **argv)
+static int gcd(int x, int y)
 {
-    int myrank, availableProcs, nproc;
-    int rows; /* amount of work per node (rows per worker) */
-    int mtype; /* message type: send/recv between master and workers */
-    int dest, src, offset;
-    double start_time, end_time;
-    int i, j, k;
-	int HALF_SIZE = SIZE / 2;
-
-    MPI_Init(&argc, &argv);
-	MPI_Comm_size(MPI_COMM_WORLD, &availableProcs);
-    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
-
-	int max_proc = MAX_PROCESSORS;
-	if (availableProcs > max_proc)
+	while (y != 0)
 	{
-		nproc = max_proc;
-	}
-	else
-	{
-		nproc = availableProcs;
+		int t = x % y;
+		x = y;
+		y = t;
 	}
 
-	// Masters tasks.
-    if (myrank == 0) 
-	{
-		// Initialization.
-		printf("SIZE = %d, number of nodes = %d\n", SIZE, availableProcs);
-		printf("%d node(s) will be used.\n", nproc);
+	return x;
+}
 
-		init_matrix();
-		start_time = MPI_Wtime();
-		
-		if (nproc == 4)
-		{
-			// One block on master and one on each node
-			// Send matrix blocks 2 to node 2.
-			MPI_Send(&a1, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_MASTER, MPI_COMM_WORLD);
-			MPI_Send(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_MASTER, MPI_COMM_WORLD);
+static int round_up(int x, int multiple)
+{
+	return (x + multiple - 1) / multiple * multiple;
+}
 
-			// Send matrix blocks 3 to node 3.
-			MPI_Send(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 2, FROM_MASTER, MPI_COMM_WORLD);
-			MPI_Send(&b1, HALF_SIZE * SIZE, MPI_DOUBLE, 2, FROM_MASTER, MPI_COMM_WORLD);
+// Arrange all nodes in a gridRows x gridCols grid, and create one
+// communicator per grid row and one per grid column for the broadcasts.
+static void setup_grid(int nproc)
+{
+	int dims[2] = { 0, 0 };
+	int periods[2] = { 0, 0 };
+	int coords[2];
+	int keepCols[2] = { 0, 1 };
+	int keepRows[2] = { 1, 0 };
+	int myrank, i;
+	int lcm, perStep;
+
+	MPI_Dims_create(nproc, 2, dims);
+	MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &gridComm);
+	MPI_Comm_rank(gridComm, &myrank);
+	MPI_Cart_coords(gridComm, myrank, 2, coords);
+
+	gridRows = dims[0];
+	gridCols = dims[1];
+	myRow = coords[0];
+	myCol = coords[1];
+
+	// rowComm ranks are ordered by column, colComm ranks by row.
+	MPI_Cart_sub(gridComm, keepCols, &rowComm);
+	MPI_Cart_sub(gridComm, keepRows, &colComm);
+
+	// Pad the sizes so they divide evenly over the grid. K is split into
+	// lcm(gridRows, gridCols) parts, so every part lies in one a and one
+	// b block, and each part into panels of at most maxPanelWidth, padding
+	// K a little more so the panels come out even.
+	lcm = gridRows / gcd(gridRows, gridCols) * gridCols;
+	Mp = round_up(M, gridRows);
+	Np = round_up(N, gridCols);
+	Kp = round_up(K, lcm);
+	perStep = (Kp / lcm + maxPanelWidth - 1) / maxPanelWidth;
+	panelWidth = (Kp / lcm + perStep - 1) / perStep;
+	summaSteps = lcm * perStep;
+	Kp = summaSteps * panelWidth;
+
+	blockRows = Mp / gridRows;
+	blockCols = Np / gridCols;
+	aBlockCols = Kp / gridCols;
+	bBlockRows = Kp / gridRows;
+	aChunks = aBlockCols / panelWidth;
+	bChunks = bBlockRows / panelWidth;
+
+	// Only the blocks this node owns, so memory scales as 1 / nproc.
+	aBlock = alloc_matrix(blockRows, aBlockCols);
+	bBlock = alloc_matrix(bBlockRows, blockCols);
+	cBlock = alloc_matrix(blockRows, blockCols);
+	aPanel[0] = alloc_matrix(blockRows, panelWidth);
+	aPanel[1] = alloc_matrix(blockRows, panelWidth);
+	bPanel[0] = alloc_matrix(panelWidth, blockCols);
+	bPanel[1] = alloc_matrix(panelWidth, blockCols);
+
+	aChunkReq = malloc(sizeof(MPI_Request) * aChunks);
+	bChunkReq = malloc(sizeof(MPI_Request) * bChunks);
+	for (i = 0; i < aChunks; i++)
+	{
+		aChunkReq[i] = MPI_REQUEST_NULL;
+	}
+	for (i = 0; i < bChunks; i++)
+	{
+		bChunkReq[i] = MPI_REQUEST_NULL;
+	}
+}
 
-			// Send matrix blocks 4 to node 4.
-			MPI_Send(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 3, FROM_MASTER, MPI_COMM_WORLD);
-			MPI_Send(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 3, FROM_MASTER, MPI_COMM_WORLD);
+// A (rows x cols) block inside a matrix with row stride ld, resized to
+// an extent of extentCols doubles.
+static MPI_Datatype block_type(int rows, int cols, int ld, int extentCols)
+{
+	MPI_Datatype vector, resized;
 
-			// Block 1 (1,1)
-			for (i = 0; i < HALF_SIZE; i++) // Row
-			{
-				for (j = 0; j < HALF_SIZE; j++) // Element in row
-				{
-					c[i][j] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j] = c[i][j] + a1[i][k] * b1[k][j];
-					}
-				}
-			}
+	MPI_Type_vector(rows, cols, ld, MPI_DOUBLE, &vector);
+	MPI_Type_create_resized(vector, 0, (MPI_Aint)extentCols * sizeof(double), &resized);
+	MPI_Type_commit(&resized);
+	MPI_Type_free(&vector);
+	return resized;
+}
 
-			// Receive results from node 2.
-			MPI_Recv(&cQuarter, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_WORKER, MPI_COMM_WORLD, &status);
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i][j + HALF_SIZE] = cQuarter[i][j];
-				}
-			}
+static void create_types(void)
+{
+	aPanelType = block_type(blockRows, panelWidth, Kp, panelWidth);
+	bPanelType = block_type(panelWidth, blockCols, Np, blockCols);
+	cBlockType = block_type(blockRows, blockCols, Np, blockCols);
+}
 
-			// Receive results from node 3.
-			MPI_Recv(&cQuarter, HALF_SIZE * SIZE, MPI_DOUBLE, 2, FROM_WORKER, MPI_COMM_WORLD, &status);
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i + HALF_SIZE][j] = cQuarter[i][j];
-				}
-			}
+static void free_types(void)
+{
+	MPI_Type_free(&aPanelType);
+	MPI_Type_free(&bPanelType);
+	MPI_Type_free(&cBlockType);
+}
 
-			// Receive results from node 4.
-			MPI_Recv(&cQuarter, HALF_SIZE * SIZE, MPI_DOUBLE, 3, FROM_WORKER, MPI_COMM_WORLD, &status);
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i + HALF_SIZE][j + HALF_SIZE] = cQuarter[i][j];
-				}
-			}
+// Scatter block (row, col) of a and b to every node with one MPI_Iscatterv
+// per panel, straight out of the full matrices. Nodes can start on the
+// first SUMMA steps while the later panels are still on their way.
+static void distribute_blocks(int nproc)
+{
+	size_t aSize = (size_t)blockRows * panelWidth;
+	size_t bSize = (size_t)panelWidth * blockCols;
+	int *counts = malloc(sizeof(int) * nproc);
+	int *aDispls = malloc(sizeof(int) * nproc);
+	int *bDispls = malloc(sizeof(int) * nproc);
+	int rank, coords[2];
+	int t;
+
+	timing_begin(PHASE_DISTRIBUTE);
+	for (t = 0; t < aChunks || t < bChunks; t++)
+	{
+		// Displacements in units of the resized panel types.
+		for (rank = 0; rank < nproc; rank++)
+		{
+			MPI_Cart_coords(gridComm, rank, 2, coords);
+			counts[rank] = 1;
+			aDispls[rank] = coords[0] * blockRows * summaSteps + coords[1] * aChunks + t;
+			bDispls[rank] = (coords[0] * bBlockRows + t * panelWidth) * gridCols + coords[1];
 		}
 
-		else if (nproc == 2)
+		if (t < aChunks)
 		{
+			MPI_Iscatterv(a, counts, aDispls, aPanelType, &aBlock[t * aSize], (int)aSize, MPI_DOUBLE,
+				0, gridComm, &aChunkReq[t]);
+		}
+		if (t < bChunks)
+		{
+			MPI_Iscatterv(b, counts, bDispls, bPanelType, &bBlock[t * bSize], (int)bSize, MPI_DOUBLE,
+				0, gridComm, &bChunkReq[t]);
+		}
+	}
+	timing_end(PHASE_DISTRIBUTE, (long)sizeof(double) * (aChunks * aSize + bChunks * bSize));
 
-			// Send matrix blocks to the node
-			MPI_Send(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_MASTER, MPI_COMM_WORLD);
-			MPI_Send(&b1, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_MASTER, MPI_COMM_WORLD);
-			MPI_Send(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_MASTER, MPI_COMM_WORLD);
+	free(counts);
+	free(aDispls);
+	free(bDispls);
+}
 
-			// Two blocks on master, two blocks on node
+// Complete the scatters of panels this node never had to broadcast.
+static void finish_distribution(void)
+{
+	timing_begin(PHASE_WAIT);
+	MPI_Waitall(aChunks, aChunkReq, MPI_STATUSES_IGNORE);
+	MPI_Waitall(bChunks, bChunkReq, MPI_STATUSES_IGNORE);
+	timing_end(PHASE_WAIT, 0);
+}
 
-			// Block 1 (1,1)
-			for (i = 0; i < HALF_SIZE; i++) // Row
-			{
-				for (j = 0; j < HALF_SIZE; j++) // Element in row
-				{
-					c[i][j] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j] = c[i][j] + a1[i][k] * b1[k][j];
-					}
-				}
-			}
+// Start the broadcasts of the panels for one SUMMA step into panel
+// buffer set buf. The owners broadcast straight from their blocks, once
+// the panel has arrived from the master.
+static void start_panels(int step, int buf, double **aCurrent, double **bCurrent, MPI_Request *req)
+{
+	int k = step * panelWidth;
+	int aOwner = k / aBlockCols;
+	int bOwner = k / bBlockRows;
 
-			// Block 2 (1,2)
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i][j + HALF_SIZE] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j + HALF_SIZE] = c[i][j + HALF_SIZE] + a1[i][k] * b2[k][j];
-					}
-				}
-			}
+	aCurrent[buf] = aPanel[buf];
+	bCurrent[buf] = bPanel[buf];
 
-			// Receive result
-			MPI_Recv(&cHalf, HALF_SIZE * SIZE, MPI_DOUBLE, 1, FROM_WORKER, MPI_COMM_WORLD, &status);
-			
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < SIZE; j++)
-				{
-					c[i + HALF_SIZE][j] = cHalf[i][j];
-				}
-			}
-		}
+	if (myCol == aOwner)
+	{
+		int t = (k % aBlockCols) / panelWidth;
+		timing_begin(PHASE_WAIT);
+		MPI_Wait(&aChunkReq[t], MPI_STATUS_IGNORE);
+		timing_end(PHASE_WAIT, 0);
+		aCurrent[buf] = &aBlock[(size_t)t * blockRows * panelWidth];
+	}
+	timing_begin(PHASE_BROADCAST);
+	MPI_Ibcast(aCurrent[buf], blockRows * panelWidth, MPI_DOUBLE, aOwner, rowComm, &req[0]);
+	timing_end(PHASE_BROADCAST, (long)sizeof(double) * blockRows * panelWidth);
 
-		else
-		{
-			// All blocks on master
-			// Could be done as one block, but separating blocks to enable abstraction to nproc 2 and 4
+	if (myRow == bOwner)
+	{
+		int t = (k % bBlockRows) / panelWidth;
+		timing_begin(PHASE_WAIT);
+		MPI_Wait(&bChunkReq[t], MPI_STATUS_IGNORE);
+		timing_end(PHASE_WAIT, 0);
+		bCurrent[buf] = &bBlock[(size_t)t * panelWidth * blockCols];
+	}
+	timing_begin(PHASE_BROADCAST);
+	MPI_Ibcast(bCurrent[buf], panelWidth * blockCols, MPI_DOUBLE, bOwner, colComm, &req[1]);
+	timing_end(PHASE_BROADCAST, (long)sizeof(double) * panelWidth * blockCols);
+}
 
-			// Block 1 (1,1)
-			for (i = 0; i < HALF_SIZE; i++) // Row
-			{
-				for (j = 0; j < HALF_SIZE; j++) // Element in row
-				{
-					c[i][j] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j] = c[i][j] + a1[i][k] * b1[k][j];
-					}
-				}
-			}
+// SUMMA: in every step the owners of the current column panel of a and
+// row panel of b broadcast them along their grid row and grid column,
+// and every node adds the panel product to its c block. The broadcasts
+// for step + 1 are started before step is multiplied.
+static void summa(void)
+{
+	double *aCurrent[2], *bCurrent[2];
+	MPI_Request req[2][2];
+	int step;
 
-			// Block 2 (1,2)
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i][j + HALF_SIZE] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j + HALF_SIZE] = c[i][j + HALF_SIZE] + a1[i][k] * b2[k][j];
-					}
-				}
-			}
-			
-			// Block 3 (2,1)
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i + HALF_SIZE][j] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i + HALF_SIZE][j] = c[i + HALF_SIZE][j] + a2[i][k] * b1[k][j];
-					}
-				}
-			}	
-			
-			// Block 4 (2,2)
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i + HALF_SIZE][j + HALF_SIZE] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i + HALF_SIZE][j + HALF_SIZE] = c[i + HALF_SIZE][j + HALF_SIZE] + a2[i][k] * b2[k][j];
-					}
-				}
-			}
-		}
+	start_panels(0, 0, aCurrent, bCurrent, req[0]);
 
-		end_time = MPI_Wtime();
+	for (step = 0; step < summaSteps; step++)
+	{
+		int buf = step % 2;
 
-		if (DEBUG)
+		timing_begin(PHASE_WAIT);
+		MPI_Waitall(2, req[buf], MPI_STATUSES_IGNORE);
+		timing_end(PHASE_WAIT, 0);
+		if (step + 1 < summaSteps)
 		{
-			print_matrix();
+			start_panels(step + 1, 1 - buf, aCurrent, bCurrent, req[1 - buf]);
 		}
 
-		double time_taken = (end_time - start_time);
-		printf("Execution time on %2d nodes: %f\n", nproc, time_taken);
-    } 
-	
-	// Worker tasks.
-	else if(myrank < nproc)
+		timing_begin(PHASE_COMPUTE);
+		counters_start(&gemmRegion);
+		gemm(blockRows, blockCols, panelWidth, aCurrent[buf], panelWidth, bCurrent[buf], blockCols,
+			cBlock, blockCols);
+		counters_stop(&gemmRegion);
+		timing_end(PHASE_COMPUTE, 0);
+	}
+}
+
+// Gather block (row, col) of c from every node straight into place in
+// the full c matrix on the master.
+static void collect_blocks(int nproc)
+{
+	int *counts = malloc(sizeof(int) * nproc);
+	int *displs = malloc(sizeof(int) * nproc);
+	int rank, coords[2];
+
+	for (rank = 0; rank < nproc; rank++)
 	{
-		if (nproc == 2)
+		MPI_Cart_coords(gridComm, rank, 2, coords);
+		counts[rank] = 1;
+		displs[rank] = coords[0] * blockRows * gridCols + coords[1];
+	}
+
+	timing_begin(PHASE_GATHER);
+	MPI_Gatherv(cBlock, blockRows * blockCols, MPI_DOUBLE, c, counts, displs, cBlockType, 0, gridComm);
+	timing_end(PHASE_GATHER, (long)sizeof(double) * blockRows * blockCols);
+
+	free(counts);
+	free(displs);
+}
+
+// With a[i][k] = i + k and b[k][j] = k + j,
+//   c[i][j] = sum (i + k)(k + j) = K i j + (i + j) K(K-1)/2 + (K-1)K(2K-1)/6,
+// summing k from 0 to K-1. All terms are integers well below 2^53, so the
+// result is exact whatever the summation order. Every node checks its own
+// block, so this works without gathering c.
+static long check_result(void)
+{
+	long errors = 0, totalErrors = 0;
+	double k = K;
+	double s1 = k * (k - 1) / 2;
+	double s2 = (k - 1) * k * (2 * k - 1) / 6;
+	int x, y;
+
+	for (x = 0; x < blockRows; x++)
+	{
+		for (y = 0; y < blockCols; y++)
 		{
-			MPI_Recv(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
-			MPI_Recv(&b1, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
-			MPI_Recv(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
+			double i = myRow * blockRows + x;
+			double j = myCol * blockCols + y;
+			double expected = (i < M && j < N) ? k * i * j + (i + j) * s1 + s2 : 0.0;
 
-			// Block 3 (2,1)
-			for (i = 0; i < HALF_SIZE; i++)
+			if (cBlock[(size_t)x * blockCols + y] != expected)
 			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i][j] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j] = c[i][j] + a2[i][k] * b1[k][j];
-					}
-				}
+				errors++;
 			}
+		}
+	}
 
-			// Block 4 (2,2)
-			for (i = 0; i < HALF_SIZE; i++)
-			{
-				for (j = 0; j < HALF_SIZE; j++)
-				{
-					c[i][j + HALF_SIZE] = 0.0f;
-					for (k = 0; k < SIZE; k++)
-					{
-						c[i][j + HALF_SIZE] = c[i][j + HALF_SIZE] + a2[i][k] * b2[k][j];
-					}
-				}
-			}
+	timing_begin(PHASE_REDUCE);
+	MPI_Reduce(&errors, &totalErrors, 1, MPI_LONG, MPI_SUM, 0, gridComm);
+	timing_end(PHASE_REDUCE, sizeof(long));
+	return totalErrors;
+}
 
-			MPI_Send(&c, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_WORKER, MPI_COMM_WORLD); // Send result back
+// Counters of every node in turn. Each SUMMA step reads the two panels
+// and reads and writes the c block.
+static void report_counters(int myrank, int nproc)
+{
+	char label[32];
+	int rank;
 
-		}
-		else if (nproc == 4)
-		{
-			// NODE 2.
-			if (myrank == 1)
-			{
-				MPI_Recv(&a1, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
-				MPI_Recv(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
+	if (gemmRegion.threads == 0)
+	{
+		return;
+	}
 
-				// Block 2 (1,2)
-				for (i = 0; i < HALF_SIZE; i++)
-				{
-					for (j = 0; j < HALF_SIZE; j++)
-					{
-						cQuarter[i][j] = 0.0f;
-						for (k = 0; k < SIZE; k++)
-						{
-							cQuarter[i][j] = cQuarter[i][j] + a1[i][k] * b2[k][j];
-						}
-					}
-				}
+	snprintf(label, sizeof(label), "[node %d] ", myrank);
+	for (rank = 0; rank < nproc; rank++)
+	{
+		if (rank == myrank)
+		{
+			counters_report(&gemmRegion, label, 2.0 * blockRows * blockCols * Kp,
+				(double)sizeof(double) * summaSteps * ((double)blockRows * panelWidth + (double)panelWidth * blockCols
+				+ 2.0 * blockRows * blockCols));
+			fflush(stdout);
+		}
+		MPI_Barrier(gridComm);
+	}
+}
 
-				// Send node 2 results back.
-				MPI_Send(&cQuarter, HALF_SIZE * HALF_SIZE, MPI_DOUBLE, 0, FROM_WORKER, MPI_COMM_WORLD);
-			}
+int main(int argc, char **argv)
+{
+	int myrank, nproc;
+	double start_time = 0.0, end_time;
+	long errors;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+	MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+	read_options(argc, argv, myrank);
+	setup_grid(nproc);
+	create_types();
+	MPI_Comm_rank(gridComm, &myrank);
+	if (timing)
+	{
+		timing_init(gridComm, PHASES, phaseNames, traceFile);
+	}
+	counters_open(&gemmRegion, "gemm");
 
-			// NODE 3.
-			else if (myrank == 2)
-			{
-				MPI_Recv(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
-				MPI_Recv(&b1, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
+	// Masters tasks.
+	if (myrank == 0)
+	{
+		// Initialization.
+		printf("SIZE = %d x %d x %d, number of nodes = %d\n", M, K, N, nproc);
+		printf("%d x %d node grid will be used, %d x %d blocks.\n",
+			gridRows, gridCols, blockRows, blockCols);
+		printf("gemm kernel: %s\n", gemm_kernel_name());
 
-				// Block 3 (2,1)
-				for (i = 0; i < HALF_SIZE; i++)
-				{
-					for (j = 0; j < HALF_SIZE; j++)
-					{
-						cQuarter[i][j] = 0.0f;
-						for (k = 0; k < SIZE; k++)
-						{
-							cQuarter[i][j] = cQuarter[i][j] + a2[i][k] * b1[k][j];
-						}
-					}
-				}
+		// Verify the gemm kernels against a plain triple loop before timing.
+		if (gemm_check() != 0)
+		{
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
 
-				// Send node 3 results back.
-				MPI_Send(&cQuarter, HALF_SIZE * HALF_SIZE, MPI_DOUBLE, 0, FROM_WORKER, MPI_COMM_WORLD);
-			}
+		if (!distributedInit)
+		{
+			init_matrix();
+		}
+		start_time = MPI_Wtime();
+	}
 
-			// NODE 4.
-			else if (myrank == 3)
-			{
-				MPI_Recv(&a2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
-				MPI_Recv(&b2, HALF_SIZE * SIZE, MPI_DOUBLE, 0, FROM_MASTER, MPI_COMM_WORLD, &status);
+	// All nodes, including the master, take part in the multiplication.
+	if (distributedInit)
+	{
+		timing_begin(PHASE_DISTRIBUTE);
+		init_blocks();
+		timing_end(PHASE_DISTRIBUTE, 0);
+	}
+	else
+	{
+		distribute_blocks(nproc);
+	}
+	summa();
+	finish_distribution();
+	if (!distributedInit)
+	{
+		collect_blocks(nproc);
+	}
 
-				// Block 4 (2,2)
-				for (i = 0; i < HALF_SIZE; i++)
-				{
-					for (j = 0; j < HALF_SIZE; j++)
-					{
-						cQuarter[i][j] = 0.0f;
-						for (k = 0; k < SIZE; k++)
-						{
-							cQuarter[i][j] = cQuarter[i][j] + a2[i][k] * b2[k][j];
-						}
-					}
-				}
+	if (myrank == 0)
+	{
+		end_time = MPI_Wtime();
 
-				// Send node 4 results back.
-				MPI_Send(&cQuarter, HALF_SIZE * HALF_SIZE, MPI_DOUBLE, 0, FROM_WORKER, MPI_COMM_WORLD); 
-			}
+		if (DEBUG && !distributedInit)
+		{
+			print_matrix();
 		}
-    }
 
-    MPI_Finalize();
-    return 0;
+		double time_taken = (end_time - start_time);
+		printf("Execution time on %2d nodes: %f\n", nproc, time_taken);
+	}
+
+	errors = check_result();
+	if (myrank == 0 && errors != 0)
+	{
+		printf("[FAILURE] %ld elements of c are wrong.\n", errors);
+	}
+	timing_report();
+	report_counters(myrank, nproc);
+
+	free(aBlock);
+	free(bBlock);
+	free(cBlock);
+	free(aPanel[0]);
+	free(aPanel[1]);
+	free(bPanel[0]);
+	free(bPanel[1]);
+	free(aChunkReq);
+	free(bChunkReq);
+	if (myrank == 0 && !distributedInit)
+	{
+		free(a);
+		free(b);
+		free(c);
+	}
+
+	free_types();
+	MPI_Comm_free(&rowComm);
+	MPI_Comm_free(&colComm);
+	MPI_Comm_free(&gridComm);
+	MPI_Finalize();
+	return (errors == 0) ? 0 : 1;
 }
@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
+#include "gemm.h"
+#include "counters.h"
 
 
 #define SIZE 1024
@@ -34,15 +36,12 @@ init_matrix(void)
 static void
 matmul_seq()
 {
-    int i, j, k;
+    int i, j;
 
-    for (i = 0; i < SIZE; i++) {
-        for (j = 0; j < SIZE; j++) {
+    for (i = 0; i < SIZE; i++)
+        for (j = 0; j < SIZE; j++)
             c[i][j] = 0.0;
-            for (k = 0; k < SIZE; k++)
-                c[i][j] = c[i][j] + a[i][k] * b[k][j];
-        }
-    }
+    gemm(SIZE, SIZE, SIZE, &a[0][0], SIZE, &b[0][0], SIZE, &c[0][0], SIZE);
 }
 
 static void
@@ -62,21 +61,30 @@ main(int argc, char **argv)
 {
 	MPI_Init(&argc, &argv);
 	double start_time, end_time;
+	struct counter_region region;
 	int myRank;
 	MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
 	
 	if (myRank == 0)
 	{
+		printf("gemm kernel: %s\n", gemm_kernel_name());
+		if (gemm_check() != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
 		init_matrix();
 		printf("Init done.\n");
+		counters_open(&region, "matmul_seq");
 		start_time = MPI_Wtime();
 		printf("Start time: %f\n", start_time);
+		counters_start(&region);
 		matmul_seq();
+		counters_stop(&region);
 		end_time = MPI_Wtime();
 		printf("End time: %f\n", end_time);
 
 		double timetaken = end_time - start_time;
 		printf("Time: %f\n", timetaken);
+		/* a, b and c are read or written at least once */
+		counters_report(&region, "", 2.0 * SIZE * SIZE * SIZE, 3.0 * sizeof(double) * SIZE * SIZE);
 		//print_matrix();
 	}
 	MPI_Finalize();
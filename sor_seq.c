@@ -9,26 +9,88 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
+#include <time.h>
+#include "counters.h"
+#include "grid.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num()	0
+#define omp_get_num_threads()	1
+#define omp_get_max_threads()	1
+#endif
 
 #define MAX_SIZE 4096
 #define EVEN_TURN 0 /* shall we calculate the 'red' or the 'black' elements */
 #define ODD_TURN  1
+#define PAD 8	/* doubles per cache line, keeps the threads' partial sums apart */
 
-typedef double matrix[MAX_SIZE+2][MAX_SIZE+2]; /* (+2) - boundary elements */
+/* Stop conditions (-c), and what a half sweep measures for them */
+#define CRIT_NONE   -1	/* nothing, no check after this half sweep	*/
+#define CRIT_ROWSUM 0	/* max row sum, against two half sweeps back	*/
+#define CRIT_DELTA  1	/* largest change of an element			*/
+#define CRIT_LINF   2	/* largest residual				*/
+#define CRIT_L2	    3	/* 2-norm of the residual			*/
+
+/* names of the stop conditions for -c, by number */
+const char *crit_names[] = { "rowsum", "delta", "linf", "l2" };
+
+typedef double (*rows)[MAX_SIZE+2];	/* rows of a matrix, (+2) - boundary elements */
 
 volatile struct globmem {
     int		N;		/* matrix size		*/
     int		maxnum;		/* max number of element*/
     char	*Init;		/* matrix init type	*/
+    char	*Solver;	/* sor, mixed, mg, fmg or cg */
+    char	*Precond;	/* jacobi, ssor or mg	*/
     double	difflimit;	/* stop condition	*/
     double	w;		/* relaxation factor	*/
     int		PRINT;		/* print switch		*/
-    matrix	A;		/* matrix A		*/
+    int		SPLIT;		/* colour split storage	*/
+    int		THREADS;	/* number of threads	*/
+    int		BLOCK;		/* half sweeps per block*/
+    int		CRIT;		/* stop condition	*/
+    int		CHECK;		/* check interval	*/
+    rows	A;		/* matrix A, N+2 rows	*/
 } *glob;
 
+/* What one half sweep measured. The change of an element is w / 4 times
+ * its residual just before the update, so the residuals come for free
+ * from the changes: delta is the largest change, sumsq the sum of the
+ * squared changes. */
+struct measure {
+    double	rowsum;		/* largest row sum	*/
+    double	delta;		/* largest change	*/
+    double	sumsq;		/* sum of changes^2	*/
+};
+
+/* Colour split storage: the red elements ((m + n) even) of row m are
+ * kept compacted in red[m * W ...], the black ones in black[m * W ...],
+ * W = (N + 3) / 2. Element (m, n) is at index n / 2 of its colour. */
+double *red, *black;
+
+/* Single precision copy of glob->A for -s mixed, row m at fA[m * (N+2)],
+ * or of red and black with -S 1, in fred and fblack */
+float *fA, *fred, *fblack;
+
 /* forward declarations */
 int work();
+int work_split();
+int work_blocked();
+int work_multigrid();
+int work_cg();
+int work_mixed();
+int iterate(double, int);
+void sweep_split(double *, const double *, int, int, int, int, int, double,
+		 int, struct measure *);
+void sweep_split_float(float *, const float *, int, int, int, int, int, float,
+		       int, struct measure *);
+void split_colors(int, int);
+void merge_colors(int, int);
+double wall_time();
 void Init_Matrix();
 void Print_Matrix();
 void Init_Default();
@@ -37,103 +99,1045 @@ int Read_Options(int, char **);
 int 
 main(int argc, char **argv)
 {
-    int i, timestart, timeend, iter;
+    struct counter_region region;
+    double points, flops, bytes;
+    double timestart, timeend;
+    int iter;
  
     glob = (struct globmem *) malloc(sizeof(struct globmem));
 
     Init_Default();		/* Init default values	*/
     Read_Options(argc,argv);	/* Read arguments	*/
+    if (glob->w <= 0.0)		/* -w auto		*/
+	glob->w = 2.0 / (1.0 + sin(M_PI / (glob->N + 1)));
+    if (glob->BLOCK > 1) {
+	/* work_blocked() is the sor solver on the natural layout, and its
+	 * wavefront runs on one thread */
+	if (strcmp(glob->Solver, "sor") != 0) {
+	    printf("-B only works with -s sor\n");
+	    exit(1);
+	}
+	if (glob->SPLIT) {
+	    printf("-B and -S can not be combined, use one of them\n");
+	    exit(1);
+	}
+	if (glob->THREADS > 1) {
+	    printf("-B and -t can not be combined, use one of them\n");
+	    exit(1);
+	}
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(glob->THREADS);
+#endif
+    glob->A = (rows) grid_alloc(glob->N+2, MAX_SIZE+2, NULL);
+    if (glob->A == NULL) {
+	fprintf(stderr, "Out of memory for a %dx%d matrix\n", glob->N, glob->N);
+	exit(1);
+    }
     Init_Matrix();		/* Init the matrix	*/
-    iter = work();
+    counters_open(&region, glob->Solver);
+    timestart = wall_time();
+    counters_start(&region);
+    if (strcmp(glob->Solver, "mg") == 0 || strcmp(glob->Solver, "fmg") == 0)
+	iter = work_multigrid();
+    else if (strcmp(glob->Solver, "cg") == 0)
+	iter = work_cg();
+    else if (strcmp(glob->Solver, "mixed") == 0)
+	iter = work_mixed();
+    else if (glob->BLOCK > 1)
+	iter = work_blocked();
+    else if (glob->SPLIT)
+	iter = work_split();
+    else
+	iter = work();
+    counters_stop(&region);
+    timeend = wall_time();
     if (glob->PRINT == 1)
 	Print_Matrix();
     printf("\nNumber of iterations = %d\n", iter);
+    printf("Time: %f\n", timeend - timestart);	/* the solver alone */
+
+    /* Model of the SOR sweeps: 7 flops per update, half the elements per
+     * half sweep, and the matrix read and written once per half sweep.
+     * None for the other solvers. */
+    points = (double) glob->N * glob->N * iter;
+    flops = bytes = 0.0;
+    if (strcmp(glob->Solver, "sor") == 0 || strcmp(glob->Solver, "mixed") == 0) {
+	flops = 3.5 * points;
+	bytes = 2 * sizeof(double) * points;
+    }
+    counters_report(&region, "", flops, bytes);
+}
+
+/* Rows of the interior handled by the calling thread. The matrix is
+ * initialized (first touch) and swept with the same split, so each
+ * thread works on memory of its own NUMA node. With border set the
+ * first and last thread also take the border rows 0 and N+1. */
+void
+thread_rows(int N, int border, int *mfirst, int *mlast)
+{
+    int t = omp_get_thread_num(), T = omp_get_num_threads();
+
+    *mfirst = 1 + t * N / T;
+    *mlast = (t + 1) * N / T;
+    if (border && t == 0)
+	*mfirst = 0;
+    if (border && t == T - 1)
+	*mlast = N + 1;
+}
+
+/* Seconds since some fixed point in the past */
+double
+wall_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* What half sweep iteration has to measure. The row sums are compared
+ * with those of two half sweeps back, the other conditions take the
+ * changes of the last two half sweeps, one of each colour. */
+int
+measure_needed(int iteration)
+{
+    int k = glob->CHECK;
+
+    if (glob->CRIT == CRIT_ROWSUM)
+	return (iteration % k == 0 || (iteration + 2) % k == 0)
+	    ? CRIT_ROWSUM : CRIT_NONE;
+    return (iteration % k == 0 || (iteration + 1) % k == 0)
+	? glob->CRIT : CRIT_NONE;
+}
+
+/* Check the stop condition after half sweep iteration, of colour turn,
+ * every glob->CHECK half sweeps, against limit. ms is what it measured,
+ * last[] holds the measures of the last half sweep of each colour. */
+int
+converged(int iteration, int turn, struct measure *ms, struct measure *last,
+	  double w, double limit, int print)
+{
+    double value;
+    int finished = 0;
+
+    if (iteration % glob->CHECK == 0) {
+	if (glob->CRIT == CRIT_ROWSUM) {
+	    /* Compare the sum with the prev sum of the same colour */
+	    if (fabs(ms->rowsum - last[turn].rowsum) <= limit)
+		finished = 1;
+	    if ((iteration%100) == 0 && print)
+		printf("Iteration: %d, maxi = %f, prevmax_%s = %f\n",
+		       iteration, ms->rowsum,
+		       (turn == EVEN_TURN) ? "even" : "odd",
+		       last[turn].rowsum);
+	} else {
+	    if (glob->CRIT == CRIT_L2)
+		value = 4 / w * sqrt(ms->sumsq + last[1-turn].sumsq);
+	    else {
+		value = (ms->delta > last[1-turn].delta)
+		    ? ms->delta : last[1-turn].delta;
+		if (glob->CRIT == CRIT_LINF)
+		    value *= 4 / w;
+	    }
+	    if (value <= limit)
+		finished = 1;
+	    if ((iteration%100) == 0 && print)
+		printf("Iteration: %d, %s = %e\n", iteration,
+		       (glob->CRIT == CRIT_DELTA) ? "delta" :
+		       (glob->CRIT == CRIT_LINF) ? "residual_max" : "residual_l2",
+		       value);
+	}
+    }
+    last[turn] = *ms;
+    return finished;
+}
+
+/* Update the elements of one colour in rows mfirst..mlast and measure
+ * what the stop condition needs, in the same pass: the row is final as
+ * soon as its elements of this colour are updated. */
+void
+sweep(int colour, int mfirst, int mlast, int N, double w, int what,
+      struct measure *ms)
+{
+    double sum;
+    int m;
+
+    ms->rowsum = -999999.0;
+    ms->delta = 0.0;
+    ms->sumsq = 0.0;
+    for (m = mfirst; m <= mlast; m++) {
+	/* the first element of this colour in row m is n = 1 or 2 */
+	grid_sor_row(glob->A[m], glob->A[m-1], glob->A[m+1],
+		     1 + (m + 1 + colour) % 2, N, w,
+		     what > CRIT_ROWSUM ? &ms->delta : NULL,
+		     what == CRIT_L2 ? &ms->sumsq : NULL);
+	if (what == CRIT_ROWSUM) {
+	    sum = grid_row_sum(glob->A[m], 1, N);
+	    if (sum > ms->rowsum)
+		ms->rowsum = sum;
+	}
+    }
+}
+
+/* Update the elements of one colour in rows mfirst..mlast of fA, like
+ * sweep(). The arithmetic is single precision, the measures are summed
+ * in double. */
+void
+sweep_float(int colour, int mfirst, int mlast, int N, float w, int what,
+	    struct measure *ms)
+{
+    double sum;
+    int m, W = N + 2;
+
+    ms->rowsum = -999999.0;
+    ms->delta = 0.0;
+    ms->sumsq = 0.0;
+    for (m = mfirst; m <= mlast; m++) {
+	grid_sor_row_float(&fA[m*W], &fA[(m-1)*W], &fA[(m+1)*W],
+			   1 + (m + 1 + colour) % 2, N, w,
+			   what > CRIT_ROWSUM ? &ms->delta : NULL,
+			   what == CRIT_L2 ? &ms->sumsq : NULL);
+	if (what == CRIT_ROWSUM) {
+	    sum = grid_row_sum_float(&fA[m*W], 1, N);
+	    if (sum > ms->rowsum)
+		ms->rowsum = sum;
+	}
+    }
 }
 
 int
 work()
 {
-    double prevmax_even, prevmax_odd, maxi, sum, w;
-    int	m, n, N, i;
+    return iterate(glob->difflimit, 0);
+}
+
+/* The iteration loop, run by every thread on its own rows, until the
+ * stop condition is below limit; on fA when single is set. Each thread
+ * leaves the measures of its rows in partial[turn] and the only
+ * synchronization is the barrier between the two colours. After it all
+ * threads combine partial[turn] themselves and so reach the same
+ * decision. partial is double buffered by colour: a thread can only
+ * write partial[turn] again after the next barrier, when everyone is done
+ * reading it. */
+int
+iterate(double limit, int single)
+{
+    double *partial[2];
+    int T, N, W, iterations = 0;
+
+    N = glob->N;
+    W = (N + 3) / 2;
+    T = omp_get_max_threads();
+    partial[EVEN_TURN] = malloc(sizeof(double) * T * PAD);
+    partial[ODD_TURN] = malloc(sizeof(double) * T * PAD);
+
+#pragma omp parallel
+    {
+	struct measure ms, last[2];
+	double *mine, *other, w = glob->w;
+	int t, what, mfirst, mlast;
+	int finished = 0;
+	int turn = EVEN_TURN;
+	int iteration = 0;
+
+	memset(last, 0, sizeof(last));
+	thread_rows(N, 0, &mfirst, &mlast);
+
+	while (!finished) {
+	    iteration++;
+	    what = measure_needed(iteration);
+	    /* CALCULATE the elements of this turn's colour, and measure
+	     * them for the stop condition */
+	    if (single && !glob->SPLIT)
+		sweep_float(turn, mfirst, mlast, N, w, what, &ms);
+	    else if (single && turn == EVEN_TURN)
+		sweep_split_float(fred, fblack, EVEN_TURN, mfirst, mlast, N, W,
+				  w, what, &ms);
+	    else if (single)
+		sweep_split_float(fblack, fred, ODD_TURN, mfirst, mlast, N, W,
+				  w, what, &ms);
+	    else if (!glob->SPLIT)
+		sweep(turn, mfirst, mlast, N, w, what, &ms);
+	    else if (turn == EVEN_TURN)
+		sweep_split(red, black, EVEN_TURN, mfirst, mlast, N, W, w,
+			    what, &ms);
+	    else
+		sweep_split(black, red, ODD_TURN, mfirst, mlast, N, W, w,
+			    what, &ms);
+	    mine = &partial[turn][omp_get_thread_num() * PAD];
+	    mine[0] = ms.rowsum;
+	    mine[1] = ms.delta;
+	    mine[2] = ms.sumsq;
+#pragma omp barrier
+	    if (what != CRIT_NONE) {
+		ms.sumsq = 0.0;
+		for (t = 0; t < omp_get_num_threads(); t++) {
+		    other = &partial[turn][t * PAD];
+		    if (other[0] > ms.rowsum)
+			ms.rowsum = other[0];
+		    if (other[1] > ms.delta)
+			ms.delta = other[1];
+		    ms.sumsq += other[2];
+		}
+		finished = converged(iteration, turn, &ms, last, w, limit,
+				     omp_get_thread_num() == 0);
+	    }
+	    turn = (turn == EVEN_TURN) ? ODD_TURN : EVEN_TURN;
+	    if (iteration > 100000) {
+		/* exit if we don't converge fast enough */
+		if (omp_get_thread_num() == 0)
+		    printf("Max number of iterations reached! Exit!\n");
+		finished = 1;
+	    }
+	}
+	if (omp_get_thread_num() == 0)
+	    iterations = iteration;
+    }
+
+    free(partial[EVEN_TURN]);
+    free(partial[ODD_TURN]);
+    return iterations;
+}
+
+/* Mixed precision (-s mixed): sweep in single precision, which moves
+ * half the bytes, as far as single precision gets, then go on in double
+ * from there until the stop condition is met. The double sweeps only
+ * have to remove the rounding errors and whatever error was left below
+ * the single precision limit. With -S 1 both stages use the colour split
+ * storage. */
+int
+work_mixed()
+{
+    double amax, floor, limit;
+    int m, n, N, W, iteration;
+
+    N = glob->N;
+    W = glob->SPLIT ? (N + 3) / 2 : N + 2;
+    if (glob->SPLIT) {
+	red = grid_alloc(N+2, W, NULL);
+	black = grid_alloc(N+2, W, NULL);
+	fred = malloc(sizeof(float) * (N+2) * W);
+	fblack = malloc(sizeof(float) * (N+2) * W);
+    } else
+	fA = malloc(sizeof(float) * W * W);
+
+    amax = 0.0;
+    for (m = 0; m < N+2; m++)
+	for (n = 0; n < N+2; n++)
+	    if (fabs(glob->A[m][n]) > amax)
+		amax = fabs(glob->A[m][n]);
+    /* The single precision stage stops at limit, the larger of the stop
+     * condition and the level where single precision stagnates: below
+     * it the changes drown in the rounding errors and the stop condition
+     * may never be met. The level is an estimate from experiment: with
+     * the default rand matrix (amax 15) the largest change stopped
+     * going down at about 3e-5 for N = 200 and 9e-5 for N = 800, which
+     * grows about as sqrt(N); 4 * sqrt(N) * FLT_EPSILON * amax is two to
+     * three times that, to stay clear of it. The other conditions are
+     * scaled from it: a row sum adds up N changes of random sign, sqrt(N)
+     * times as much, the residuals are 4 / w times the changes, and l2
+     * adds up N of them. */
+    floor = 4 * sqrt(N) * FLT_EPSILON * amax;
+    if (glob->CRIT == CRIT_ROWSUM)
+	floor *= sqrt(N);
+    else if (glob->CRIT == CRIT_LINF)
+	floor *= 4 / glob->w;
+    else if (glob->CRIT == CRIT_L2)
+	floor *= 4 / glob->w * N;
+    limit = (glob->difflimit > floor) ? glob->difflimit : floor;
+
+    /* first touch of fA or fred and fblack, with the rows split as in
+     * the sweep */
+    if (glob->SPLIT)
+	split_colors(N, W);
+#pragma omp parallel private(m, n)
+    {
+	int mfirst, mlast;
+
+	thread_rows(N, 1, &mfirst, &mlast);
+	for (m = mfirst; m <= mlast; m++)
+	    for (n = 0; n < N+2; n++) {
+		if (!glob->SPLIT)
+		    fA[m*W + n] = glob->A[m][n];
+		else if (((m + n) % 2) == 0)
+		    fred[m*W + n/2] = glob->A[m][n];
+		else
+		    fblack[m*W + n/2] = glob->A[m][n];
+	    }
+    }
+
+    iteration = iterate(limit, 1);
+    printf("Single precision: %d iterations, limit %e\n", iteration, limit);
+
+#pragma omp parallel for private(n)
+    for (m = 1; m < N+1; m++)
+	for (n = 1; n < N+1; n++) {
+	    if (!glob->SPLIT)
+		glob->A[m][n] = fA[m*W + n];
+	    else if (((m + n) % 2) == 0)
+		red[m*W + n/2] = fred[m*W + n/2];
+	    else
+		black[m*W + n/2] = fblack[m*W + n/2];
+	}
+    free(fA);
+    free(fred);
+    free(fblack);
+    fA = fred = fblack = NULL;
+
+    iteration += iterate(glob->difflimit, 0);
+
+    if (glob->SPLIT) {
+	/* back to the natural layout for printing */
+	merge_colors(N, W);
+	free(red);
+	free(black);
+    }
+    return iteration;
+}
+
+/*--------------------------------------------------------------*/
+
+/* Copy glob->A into the red and black arrays, and back */
+void
+split_colors(int N, int W)
+{
+    int m, n;
+
+    /* first touch of red and black, with the rows split as in the sweep */
+#pragma omp parallel private(m, n)
+    {
+	int mfirst, mlast;
+
+	thread_rows(N, 1, &mfirst, &mlast);
+	for (m = mfirst; m <= mlast; m++)
+	    for (n = 0; n < N+2; n++) {
+		if (((m + n) % 2) == 0)
+		    red[m*W + n/2] = glob->A[m][n];
+		else
+		    black[m*W + n/2] = glob->A[m][n];
+	    }
+    }
+}
+
+void
+merge_colors(int N, int W)
+{
+    int m, n;
+
+    for (m = 0; m < N+2; m++)
+	for (n = 0; n < N+2; n++) {
+	    if (((m + n) % 2) == 0)
+		glob->A[m][n] = red[m*W + n/2];
+	    else
+		glob->A[m][n] = black[m*W + n/2];
+	}
+}
+
+double row_sum_split(int m, int N, int W);
+
+/* Update all elements of one colour in rows mfirst..mlast, stored in
+ * x, from the other colour, stored in y. In row m the elements of this
+ * colour sit at n = 2k + s. Their neighbours above and below have the
+ * same k in y, the ones to the left and right are k - 1 + s and k + s.
+ * Measures like sweep(), each row is summed right after its update
+ * while it is still in cache. */
+void
+sweep_split(double *x, const double *y, int colour, int mfirst, int mlast,
+	    int N, int W, double w, int what, struct measure *ms)
+{
+    double sum;
+    int m, s, kfirst, klast;
+
+    ms->rowsum = -999999.0;
+    ms->delta = 0.0;
+    ms->sumsq = 0.0;
+    for (m = mfirst; m <= mlast; m++) {
+	double *xm = &x[m*W];
+	const double *ym = &y[m*W];
+	const double *yup = &y[(m-1)*W];
+	const double *ydown = &y[(m+1)*W];
+
+	s = (m + colour) % 2;
+	kfirst = (s == 0) ? 1 : 0;	/* skip the border at n = 0 */
+	klast = (N - s) / 2;
+	grid_sor_row_split(xm, yup, ydown, ym, kfirst, klast, s, w,
+			   what > CRIT_ROWSUM ? &ms->delta : NULL,
+			   what == CRIT_L2 ? &ms->sumsq : NULL);
+	if (what == CRIT_ROWSUM) {
+	    sum = row_sum_split(m, N, W);
+	    if (sum > ms->rowsum)
+		ms->rowsum = sum;
+	}
+    }
+}
+
+/* Same as sweep_split() on fred and fblack, like sweep_float() */
+void
+sweep_split_float(float *x, const float *y, int colour, int mfirst,
+		  int mlast, int N, int W, float w, int what,
+		  struct measure *ms)
+{
+    double sum;
+    int m, s;
+
+    ms->rowsum = -999999.0;
+    ms->delta = 0.0;
+    ms->sumsq = 0.0;
+    for (m = mfirst; m <= mlast; m++) {
+	s = (m + colour) % 2;
+	grid_sor_row_split_float(&x[m*W], &y[(m-1)*W], &y[(m+1)*W], &y[m*W],
+				 (s == 0) ? 1 : 0, (N - s) / 2, s, w,
+				 what > CRIT_ROWSUM ? &ms->delta : NULL,
+				 what == CRIT_L2 ? &ms->sumsq : NULL);
+	if (what == CRIT_ROWSUM) {
+	    s = m % 2;
+	    sum = grid_row_sum_float(&fred[m*W], (s == 0) ? 1 : 0, (N - s) / 2);
+	    s = (m + 1) % 2;
+	    sum += grid_row_sum_float(&fblack[m*W], (s == 0) ? 1 : 0,
+				      (N - s) / 2);
+	    if (sum > ms->rowsum)
+		ms->rowsum = sum;
+	}
+    }
+}
+
+/* Sum of the interior elements of row m, both colours */
+double
+row_sum_split(int m, int N, int W)
+{
+    double sum;
+    int s;
+
+    s = m % 2;				/* red */
+    sum = grid_row_sum(&red[m*W], (s == 0) ? 1 : 0, (N - s) / 2);
+    s = (m + 1) % 2;			/* black */
+    sum += grid_row_sum(&black[m*W], (s == 0) ? 1 : 0, (N - s) / 2);
+    return sum;
+}
+
+/* Same algorithm as work(), on the colour split storage */
+int
+work_split()
+{
+    int	N, W, iteration;
+
+    N = glob->N;
+    W = (N + 3) / 2;
+
+    red = grid_alloc(N+2, W, NULL);
+    black = grid_alloc(N+2, W, NULL);
+    split_colors(N, W);
+
+    iteration = iterate(glob->difflimit, 0);
+
+    /* back to the natural layout for printing */
+    merge_colors(N, W);
+    free(red);
+    free(black);
+    return iteration;
+}
+
+/*--------------------------------------------------------------*/
+
+/* Temporal blocking: glob->BLOCK half sweeps are done in one pass over
+ * the matrix. The sweeps run as a wavefront over the rows, half sweep t
+ * works one row behind half sweep t - 1, so only about BLOCK + 2 rows
+ * have to stay in cache instead of streaming the whole matrix through
+ * memory for every half sweep. Every element is updated from the same
+ * values as in work(), so the results are the same. */
+
+/* Update the elements of one colour in row m. src holds the rows before
+ * this half sweep, dst gets row m after it; they are the same matrix
+ * except in the first half sweep of a block. Adds row m to what ms
+ * measures, like sweep(). */
+void
+sweep_row(rows dst, rows src, int m, int colour, int N, double w, int what,
+	  struct measure *ms)
+{
+    double sum;
+
+    /* the other colour and the border as they are, then update in dst */
+    if (dst != src)
+	memcpy(dst[m], src[m], sizeof(double) * (N+2));
+    grid_sor_row(dst[m], src[m-1], src[m+1], 1 + (m + 1 + colour) % 2, N, w,
+		 what > CRIT_ROWSUM ? &ms->delta : NULL,
+		 what == CRIT_L2 ? &ms->sumsq : NULL);
+    if (what == CRIT_ROWSUM) {
+	sum = grid_row_sum(dst[m], 1, N);
+	if (sum > ms->rowsum)
+	    ms->rowsum = sum;
+    }
+}
+
+/* Do steps half sweeps, the first one of colour turn, on src and leave
+ * the result in dst; src itself is not changed. Row m of half sweep t
+ * needs rows m - 1 .. m + 1 of half sweep t - 1, and must be done before
+ * half sweep t + 1 changes row m - 1 again. Both hold when half sweep t
+ * does row p - t in step p. ms[t] gets what half sweep t measured, the
+ * first one is half sweep iteration + 1; each row is measured as soon
+ * as it is done. */
+void
+sweep_block(rows dst, rows src, int turn, int steps, int iteration, int N,
+	    double w, struct measure *ms)
+{
+    int p, t, m;
+
+    for (t = 0; t < steps; t++) {
+	ms[t].rowsum = -999999.0;
+	ms[t].delta = 0.0;
+	ms[t].sumsq = 0.0;
+    }
+    for (p = 1; p < N + steps; p++) {
+	for (t = 0; t < steps; t++) {
+	    m = p - t;
+	    if (m < 1 || m > N)
+		continue;
+	    sweep_row(dst, (t == 0) ? src : dst, m, (turn + t) % 2, N, w,
+		      measure_needed(iteration + 1 + t), &ms[t]);
+	}
+    }
+}
+
+/* Same algorithm as work(), glob->BLOCK half sweeps at a time. The
+ * block is computed into the other of two matrices, so when the stop
+ * condition is met inside a block it is done again from the unchanged
+ * matrix, up to that half sweep. */
+int
+work_blocked()
+{
+    struct measure *ms, last[2];
+    double w;
+    rows cur, next, tmp;
+    int	m, n, t, N, steps, first, start;
     int finished = 0;
     int turn = EVEN_TURN;
     int iteration = 0;
 
-    prevmax_even = 0.0;
-    prevmax_odd = 0.0;
+    memset(last, 0, sizeof(last));
     N = glob->N;
     w = glob->w;
-    
+    steps = glob->BLOCK;
+
+    cur = glob->A;
+    next = (rows) grid_alloc(N+2, MAX_SIZE+2, NULL);
+    ms = malloc(sizeof(struct measure) * steps);
+    /* the border rows never change */
+    memcpy(next[0], cur[0], sizeof(double) * (N+2));
+    memcpy(next[N+1], cur[N+1], sizeof(double) * (N+2));
+
     while (!finished) {
-	iteration++;
-	if (turn == EVEN_TURN) {
-	    /* CALCULATE part A - even elements */
-	    for (m = 1; m < N+1; m++) {
-		for (n = 1; n < N+1; n++) {
-		    if (((m + n) % 2) == 0)
-			glob->A[m][n] = (1 - w) * glob->A[m][n] 
-			    + w * (glob->A[m-1][n] + glob->A[m+1][n] 
-				   + glob->A[m][n-1] + glob->A[m][n+1]) / 4;
-		}
-	    }
-	    /* Calculate the maximum sum of the elements */
-	    maxi = -999999.0;
-	    for (m = 1; m < N+1; m++) {
-		sum = 0.0;
-		for (n = 1; n < N+1; n++)
-		    sum += glob->A[m][n];
-		if (sum > maxi)
-		    maxi = sum;
-	    }
-	    /* Compare the sum with the prev sum, i.e., check wether 
-	     * we are finished or not. */
-	    if (fabs(maxi - prevmax_even) <= glob->difflimit)
+	first = turn;
+	start = iteration;
+	sweep_block(next, cur, first, steps, start, N, w, ms);
+	for (t = 0; t < steps; t++) {
+	    iteration++;
+	    if (measure_needed(iteration) != CRIT_NONE
+		&& converged(iteration, turn, &ms[t], last, w,
+			     glob->difflimit, 1))
 		finished = 1;
-	    if ((iteration%100) == 0)
-		printf("Iteration: %d, maxi = %f, prevmax_even = %f\n",
-		       iteration, maxi, prevmax_even);
-	    prevmax_even = maxi;
-	    turn = ODD_TURN;
-
-	} else if (turn == ODD_TURN) {
-	    /* CALCULATE part B - odd elements*/
-	    for (m = 1; m < N+1; m++) {
-		for (n = 1; n < N+1; n++) {
-		    if (((m + n) % 2) == 1)
-			glob->A[m][n] = (1 - w) * glob->A[m][n] 
-			    + w * (glob->A[m-1][n] + glob->A[m+1][n] 
-				   + glob->A[m][n-1] + glob->A[m][n+1]) / 4;
-		}
-	    }
-	    /* Calculate the maximum sum of the elements */
-	    maxi = -999999.0;
-	    for (m = 1; m < N+1; m++) {
-		sum = 0.0;
-		for (n = 1; n < N+1; n++)
-		    sum += glob->A[m][n];	
-		if (sum > maxi)			
-		    maxi = sum;
-	    }
-	    /* Compare the sum with the prev sum, i.e., check wether 
-	     * we are finished or not. */
-	    if (fabs(maxi - prevmax_odd) <= glob->difflimit)
+	    turn = (turn == EVEN_TURN) ? ODD_TURN : EVEN_TURN;
+	    if (iteration > 100000) {
+		/* exit if we don't converge fast enough */
+		printf("Max number of iterations reached! Exit!\n");
 		finished = 1;
-	    if ((iteration%100) == 0)
-		printf("Iteration: %d, maxi = %f, prevmax_odd = %f\n",
-		       iteration, maxi, prevmax_odd);
-	    prevmax_odd = maxi;
-	    turn = EVEN_TURN;
-	} else {
-	    /* something is very wrong... */
-	    printf("PANIC: Something is really wrong!!!\n");
-	    exit(-1);
+	    }
+	    if (finished)
+		break;
+	}
+	/* finished inside the block, redo it without the later half sweeps */
+	if (finished && t < steps - 1)
+	    sweep_block(next, cur, first, t + 1, start, N, w, ms);
+	tmp = cur;
+	cur = next;
+	next = tmp;
+    }
+
+    if (cur != glob->A) {
+	for (m = 0; m < N+2; m++)
+	    for (n = 0; n < N+2; n++)
+		glob->A[m][n] = cur[m][n];
+	next = cur;
+    }
+    free(next);
+    free(ms);
+    return iteration;
+}
+
+/*--------------------------------------------------------------*/
+
+/* Multigrid solver (-s mg, -s fmg). The red-black sweeps only smooth out
+ * the error quickly on the scale of a few elements, so the number of
+ * sweeps grows with N * N. A V-cycle smooths, moves the remaining smooth
+ * error to a grid with half the elements in each direction, where it is
+ * no longer smooth, and solves for it there the same way. Every cycle
+ * costs O(N * N) and cuts the error by a constant factor.
+ *
+ * Level 0 is the matrix itself. Element (i, j) of level k + 1 sits on
+ * element (2i, 2j) of level k. Every level solves L u = f with
+ * L u = (4 u[i][j] - u[i-1][j] - u[i+1][j] - u[i][j-1] - u[i][j+1]) / h2,
+ * level 0 with f = 0 and the fixed border, the coarser ones for the
+ * correction with a zero border. Works best with N = 2^k - 1, where the
+ * borders of all levels coincide. */
+
+#define MG_PRE	  2	/* smoothing sweeps before the coarse grid	*/
+#define MG_POST	  2	/* and after it					*/
+#define MG_COARSE 3	/* largest size solved on directly		*/
+#define MG_W	  1.0	/* relaxation factor of the smoother		*/
+
+struct level {
+    int		n;		/* size without the border	*/
+    double	h2;		/* squared mesh width		*/
+    double	*u, *f, *r;	/* (n + 2) x (n + 2), row by row */
+};
+
+/* Red-black sweeps on L u = f, each one starting with colour first */
+void
+mg_smooth(struct level *l, int sweeps, int first)
+{
+    int i, j, c, k, s, n = l->n, W = l->n + 2;
+    double *u = l->u, *f = l->f;
+
+    for (s = 0; s < sweeps; s++)
+	for (k = 0; k < 2; k++) {
+	    c = (first + k) % 2;
+	    for (i = 1; i < n+1; i++)
+		for (j = 1 + (i + 1 + c) % 2; j < n+1; j += 2)
+		    u[i*W + j] = (1 - MG_W) * u[i*W + j]
+			+ MG_W * (l->h2 * f[i*W + j]
+				  + u[(i-1)*W + j] + u[(i+1)*W + j]
+				  + u[i*W + j-1] + u[i*W + j+1]) / 4;
+	}
+}
+
+/* r = f - L u, returns the largest |r| */
+double
+mg_residual(struct level *l)
+{
+    int i, j, n = l->n, W = l->n + 2;
+    double *u = l->u, res, maxres = 0.0;
+
+    for (i = 1; i < n+1; i++)
+	for (j = 1; j < n+1; j++) {
+	    res = l->f[i*W + j] - (4 * u[i*W + j] - u[(i-1)*W + j]
+				   - u[(i+1)*W + j] - u[i*W + j-1]
+				   - u[i*W + j+1]) / l->h2;
+	    l->r[i*W + j] = res;
+	    if (fabs(res) > maxres)
+		maxres = fabs(res);
+	}
+    return maxres;
+}
+
+/* f of the coarse level is the residual of the fine one, full weighting.
+ * The coarse correction starts at zero. */
+void
+mg_restrict(struct level *fine, struct level *coarse)
+{
+    int i, j, fi, fj, n = coarse->n, W = coarse->n + 2, FW = fine->n + 2;
+    double *r = fine->r;
+
+    memset(coarse->u, 0, sizeof(double) * W * W);
+    memset(coarse->f, 0, sizeof(double) * W * W);
+    for (i = 1; i < n+1; i++)
+	for (j = 1; j < n+1; j++) {
+	    fi = 2 * i;
+	    fj = 2 * j;
+	    coarse->f[i*W + j] = (4 * r[fi*FW + fj]
+		+ 2 * (r[(fi-1)*FW + fj] + r[(fi+1)*FW + fj]
+		       + r[fi*FW + fj-1] + r[fi*FW + fj+1])
+		+ r[(fi-1)*FW + fj-1] + r[(fi-1)*FW + fj+1]
+		+ r[(fi+1)*FW + fj-1] + r[(fi+1)*FW + fj+1]) / 16;
 	}
+}
+
+/* Bilinear interpolation of the coarse u to the fine interior, added to
+ * the fine u (correction) or replacing it (full multigrid) */
+void
+mg_interpolate(struct level *coarse, struct level *fine, int add)
+{
+    int i, j, ci, cj, di, dj, n = fine->n, W = fine->n + 2, CW = coarse->n + 2;
+    double *cu = coarse->u, value;
+
+    for (i = 1; i < n+1; i++)
+	for (j = 1; j < n+1; j++) {
+	    ci = i / 2;
+	    cj = j / 2;
+	    di = i % 2;
+	    dj = j % 2;
+	    value = (cu[ci*CW + cj] + cu[(ci+di)*CW + cj]
+		     + cu[ci*CW + cj+dj] + cu[(ci+di)*CW + cj+dj]) / 4;
+	    if (add)
+		fine->u[i*W + j] += value;
+	    else
+		fine->u[i*W + j] = value;
+	}
+}
+
+/* The sweeps after the coarse grid start with colour post. The solver
+ * starts them with red, like the sweeps before, which smooths better.
+ * As a preconditioner for CG the cycle has to be symmetric, which needs
+ * the opposite order, black first. */
+void
+mg_vcycle(struct level *lv, int k, int levels, int post)
+{
+    if (k == levels - 1) {
+	/* small enough to solve by sweeping */
+	mg_smooth(&lv[k], 50, EVEN_TURN);
+	return;
+    }
+    mg_smooth(&lv[k], MG_PRE, EVEN_TURN);
+    mg_residual(&lv[k]);
+    mg_restrict(&lv[k], &lv[k+1]);
+    mg_vcycle(lv, k+1, levels, post);
+    mg_interpolate(&lv[k+1], &lv[k], 1);
+    mg_smooth(&lv[k], MG_POST, post);
+}
+
+/* Full multigrid: start on the coarsest level, with the border taken
+ * from the matrix, and interpolate each solution as the starting point
+ * of the next finer level, followed by one V-cycle there. */
+void
+mg_full(struct level *lv, int levels)
+{
+    int i, j, k, n, W, FW;
+
+    for (k = 1; k < levels; k++) {
+	n = lv[k].n;
+	W = n + 2;
+	FW = lv[k-1].n + 2;
+	memset(lv[k].f, 0, sizeof(double) * W * W);
+	for (i = 0; i < n+2; i++)
+	    for (j = 0; j < n+2; j++)
+		lv[k].u[i*W + j] = lv[k-1].u[2*i*FW + 2*j];
+    }
+    mg_smooth(&lv[levels-1], 50, EVEN_TURN);
+    for (k = levels - 2; k >= 0; k--) {
+	n = lv[k].n;
+	W = n + 2;
+	if (k > 0)
+	    memset(lv[k].f, 0, sizeof(double) * W * W);
+	mg_interpolate(&lv[k+1], &lv[k], 0);
+	mg_vcycle(lv, k, levels, EVEN_TURN);
+    }
+}
+
+/* Allocate the levels for a matrix of size N, returns their number */
+int
+mg_setup(struct level *lv, int N)
+{
+    int k, W, levels = 0;
+
+    for (k = N; ; k = (k - 1) / 2) {
+	lv[levels].n = k;
+	lv[levels].h2 = (double)(1 << levels) * (1 << levels);
+	W = k + 2;
+	lv[levels].u = calloc(W * W, sizeof(double));
+	lv[levels].f = calloc(W * W, sizeof(double));
+	lv[levels].r = calloc(W * W, sizeof(double));
+	levels++;
+	if (k <= MG_COARSE || (k - 1) / 2 < 1)
+	    break;
+    }
+    printf("Multigrid with %d levels, coarsest %dx%d\n", levels,
+	   lv[levels-1].n, lv[levels-1].n);
+    return levels;
+}
+
+void
+mg_free(struct level *lv, int levels)
+{
+    int k;
+
+    for (k = 0; k < levels; k++) {
+	free(lv[k].u);
+	free(lv[k].f);
+	free(lv[k].r);
+    }
+}
+
+/* Same stop condition as work(), with one V-cycle per iteration */
+int
+work_multigrid()
+{
+    struct level lv[32];
+    double prevmax, maxi, sum, res;
+    int i, j, N, W, levels;
+    int finished = 0;
+    int iteration = 0;
+
+    N = glob->N;
+    levels = mg_setup(lv, N);
+
+    W = N + 2;
+    for (i = 0; i < N+2; i++)
+	for (j = 0; j < N+2; j++)
+	    lv[0].u[i*W + j] = glob->A[i][j];
+
+    if (strcmp(glob->Solver, "fmg") == 0)
+	mg_full(lv, levels);
+
+    prevmax = 0.0;
+    while (!finished) {
+	iteration++;
+	mg_vcycle(lv, 0, levels, EVEN_TURN);
+	/* Calculate the maximum sum of the elements */
+	maxi = -999999.0;
+	for (i = 1; i < N+1; i++) {
+	    sum = 0.0;
+	    for (j = 1; j < N+1; j++)
+		sum += lv[0].u[i*W + j];
+	    if (sum > maxi)
+		maxi = sum;
+	}
+	res = mg_residual(&lv[0]);
+	printf("Cycle: %d, maxi = %f, prevmax = %f, residual = %e\n",
+	       iteration, maxi, prevmax, res);
+	if (fabs(maxi - prevmax) <= glob->difflimit)
+	    finished = 1;
+	prevmax = maxi;
 	if (iteration > 100000) {
 	    /* exit if we don't converge fast enough */
 	    printf("Max number of iterations reached! Exit!\n");
 	    finished = 1;
 	}
     }
+
+    for (i = 0; i < N+2; i++)
+	for (j = 0; j < N+2; j++)
+	    glob->A[i][j] = lv[0].u[i*W + j];
+    mg_free(lv, levels);
+    return iteration;
+}
+
+/*--------------------------------------------------------------*/
+
+/* Preconditioned conjugate gradients (-s cg). The fixed point of the
+ * sweeps solves A x = b for the interior, with
+ * (A x)[i][j] = 4 x[i][j] - x[i-1][j] - x[i+1][j] - x[i][j-1] - x[i][j+1]
+ * and b the border elements next to (i, j). A is never stored, vectors
+ * are (N + 2) x (N + 2) like the multigrid levels, with a zero border.
+ * The preconditioner (-p) is
+ *   jacobi  z = r / 4
+ *   ssor    a forward and a backward Gauss-Seidel sweep (w = 1)
+ *   mg	     one symmetric V-cycle
+ * Stops when the 2-norm of the residual is at most difflimit. */
+
+/* q = A p */
+void
+cg_apply(double *q, const double *p, int N)
+{
+    int i, j, W = N + 2;
+
+    for (i = 1; i < N+1; i++)
+	for (j = 1; j < N+1; j++)
+	    q[i*W + j] = 4 * p[i*W + j] - p[(i-1)*W + j] - p[(i+1)*W + j]
+		- p[i*W + j-1] - p[i*W + j+1];
+}
+
+double
+cg_dot(const double *x, const double *y, int N)
+{
+    int i, j, W = N + 2;
+    double sum = 0.0;
+
+    for (i = 1; i < N+1; i++)
+	for (j = 1; j < N+1; j++)
+	    sum += x[i*W + j] * y[i*W + j];
+    return sum;
+}
+
+/* z = M^-1 r */
+void
+cg_precond(double *z, const double *r, int N, struct level *lv, int levels)
+{
+    int i, j, W = N + 2;
+
+    if (strcmp(glob->Precond, "ssor") == 0) {
+	/* (D + L) y = r, then (D + U) z = D y */
+	for (i = 1; i < N+1; i++)
+	    for (j = 1; j < N+1; j++)
+		z[i*W + j] = (r[i*W + j] + z[(i-1)*W + j] + z[i*W + j-1]) / 4;
+	for (i = N; i > 0; i--)
+	    for (j = N; j > 0; j--)
+		z[i*W + j] += (z[(i+1)*W + j] + z[i*W + j+1]) / 4;
+    } else if (strcmp(glob->Precond, "mg") == 0) {
+	memcpy(lv[0].f, r, sizeof(double) * W * W);
+	memset(lv[0].u, 0, sizeof(double) * W * W);
+	mg_vcycle(lv, 0, levels, ODD_TURN);
+	memcpy(z, lv[0].u, sizeof(double) * W * W);
+    } else {
+	for (i = 1; i < N+1; i++)
+	    for (j = 1; j < N+1; j++)
+		z[i*W + j] = r[i*W + j] / 4;
+    }
+}
+
+int
+work_cg()
+{
+    struct level lv[32];
+    double *x, *r, *z, *p, *q, rz, rzold, alpha, beta, res;
+    int i, j, N, W, levels = 0;
+    int iteration = 0;
+
+    N = glob->N;
+    W = N + 2;
+    x = calloc(W * W, sizeof(double));
+    r = calloc(W * W, sizeof(double));
+    z = calloc(W * W, sizeof(double));
+    p = calloc(W * W, sizeof(double));
+    q = calloc(W * W, sizeof(double));
+    if (strcmp(glob->Precond, "mg") == 0)
+	levels = mg_setup(lv, N);
+
+    /* r = b - A x, from the matrix with its border */
+    for (i = 0; i < N+2; i++)
+	for (j = 0; j < N+2; j++)
+	    x[i*W + j] = glob->A[i][j];
+    for (i = 1; i < N+1; i++)
+	for (j = 1; j < N+1; j++)
+	    r[i*W + j] = x[(i-1)*W + j] + x[(i+1)*W + j] + x[i*W + j-1]
+		+ x[i*W + j+1] - 4 * x[i*W + j];
+    cg_precond(z, r, N, lv, levels);
+    memcpy(p, z, sizeof(double) * W * W);
+    rz = cg_dot(r, z, N);
+    res = sqrt(cg_dot(r, r, N));
+
+    while (res > glob->difflimit && iteration <= 100000) {
+	iteration++;
+	cg_apply(q, p, N);
+	alpha = rz / cg_dot(p, q, N);
+	for (i = 1; i < N+1; i++)
+	    for (j = 1; j < N+1; j++) {
+		x[i*W + j] += alpha * p[i*W + j];
+		r[i*W + j] -= alpha * q[i*W + j];
+	    }
+	cg_precond(z, r, N, lv, levels);
+	rzold = rz;
+	rz = cg_dot(r, z, N);
+	beta = rz / rzold;
+	for (i = 1; i < N+1; i++)
+	    for (j = 1; j < N+1; j++)
+		p[i*W + j] = z[i*W + j] + beta * p[i*W + j];
+	res = sqrt(cg_dot(r, r, N));
+	if ((iteration%100) == 0)
+	    printf("Iteration: %d, residual = %e\n", iteration, res);
+    }
+    if (iteration > 100000)
+	printf("Max number of iterations reached! Exit!\n");
+    printf("Residual = %e\n", res);
+
+    for (i = 1; i < N+1; i++)
+	for (j = 1; j < N+1; j++)
+	    glob->A[i][j] = x[i*W + j];
+    if (levels > 0)
+	mg_free(lv, levels);
+    free(x);
+    free(r);
+    free(z);
+    free(p);
+    free(q);
     return iteration;
 }
 
@@ -152,10 +1156,18 @@ Init_Matrix()
     printf("w	  = %f \n\n",glob->w);
     printf("Initializing matrix...");
  
-    /* Initialize all grid elements, including the boundary */
-    for (i = 0; i < glob->N+2; i++) {
-	for (j = 0; j < glob->N+2; j++) {
-	    glob->A[i][j] = 0.0;
+    /* Initialize all grid elements, including the boundary. Every thread
+     * touches the rows it will sweep first, so their pages are placed on
+     * its NUMA node; the first and last thread also take the border rows. */
+#pragma omp parallel private(i, j)
+    {
+	int mfirst, mlast;
+
+	thread_rows(N, 1, &mfirst, &mlast);
+	for (i = mfirst; i <= mlast; i++) {
+	    for (j = 0; j < N+2; j++) {
+		glob->A[i][j] = 0.0;
+	    }
 	}
     }
     if (strcmp(glob->Init,"count") == 0) {
@@ -228,9 +1240,16 @@ Init_Default()
     glob->N = 8;
     glob->difflimit = 0.00001*glob->N;
     glob->Init = "rand";
+    glob->Solver = "sor";
+    glob->Precond = "mg";
     glob->maxnum = 15.0;
     glob->w = 0.5;
     glob->PRINT = 1;
+    glob->SPLIT = 0;
+    glob->THREADS = 1;
+    glob->BLOCK = 0;
+    glob->CRIT = CRIT_ROWSUM;
+    glob->CHECK = 1;
 }
  
 int
@@ -246,29 +1265,55 @@ Read_Options(int argc, char **argv)
 		--argc;
 		glob->N = atoi(*++argv);
 		glob->difflimit = 0.00001*glob->N;
+		if (glob->N < 1 || glob->N > MAX_SIZE) {
+		    /* the rows of the matrix hold MAX_SIZE + 2 elements */
+		    printf("%s: size %d out of range, use 1-%d\n", prog, glob->N,
+			   MAX_SIZE);
+		    exit(1);
+		}
 		break;
 	    case 'h':
 		printf("\nHELP: try sor -u \n\n");
 		exit(0);
 		break;
 	    case 'u':
-		printf("\nUsage: sor [-n problemsize]\n");
+		printf("\nUsage: sor [-n problemsize] 1-%d\n", MAX_SIZE);
+		printf("           [-c stop_condition] rowsum/delta/linf/l2, \n");
+		printf("                change of the max row sum, largest change, \n");
+		printf("                max or 2-norm of the residual, below difflimit \n");
 		printf("           [-d difflimit] 0.1-0.000001 \n");
+		printf("           [-k check_interval] half sweeps between checks \n");
 		printf("           [-D] show default values \n");
 		printf("           [-h] help \n");
 		printf("           [-I init_type] fast/rand/count \n");
 		printf("           [-m maxnum] max random no \n");
 		printf("           [-P print_switch] 0/1 \n");
-		printf("           [-w relaxation_factor] 1.0-0.1 \n\n");
+		printf("           [-s solver] sor/mixed/mg/fmg/cg, mixed sweeps \n");
+		printf("                in single precision first \n");
+		printf("           [-p preconditioner] jacobi/ssor/mg, for cg \n");
+		printf("           [-S split_colours] 0/1 \n");
+		printf("           [-t threads] \n");
+		printf("           [-B half_sweeps] per pass over the matrix, e.g. 8, \n");
+		printf("                -s sor only, not with -S or -t \n");
+		printf("           [-w relaxation_factor] 1.0-0.1 or auto, \n");
+		printf("                2/(1+sin(pi/(n+1))), the optimum for SOR \n\n");
 		exit(0);
 		break;
 	    case 'D':
+		/* the values set by Init_Default() and the options before -D */
 		printf("\nDefault:  n         = %d ", glob->N);
-		printf("\n          difflimit = 0.0001 ");
-		printf("\n          Init      = rand" );
-		printf("\n          maxnum    = 5 ");
-		printf("\n          w         = 0.5 \n");
-		printf("\n          P         = 0 \n\n");
+		printf("\n          difflimit = %g (0.00001 * n) ", glob->difflimit);
+		printf("\n          Init      = %s", glob->Init);
+		printf("\n          solver    = %s", glob->Solver);
+		printf("\n          precond   = %s", glob->Precond);
+		printf("\n          maxnum    = %d ", glob->maxnum);
+		printf("\n          w         = %g \n", glob->w);
+		printf("\n          P         = %d ", glob->PRINT);
+		printf("\n          S         = %d ", glob->SPLIT);
+		printf("\n          t         = %d ", glob->THREADS);
+		printf("\n          B         = %d ", glob->BLOCK);
+		printf("\n          c         = %s ", crit_names[glob->CRIT]);
+		printf("\n          k         = %d \n\n", glob->CHECK);
 		exit(0);
 		break;
 	    case 'I':
@@ -285,12 +1330,72 @@ Read_Options(int argc, char **argv)
 		break;
 	    case 'w':
 		--argc;
-		glob->w = atof(*++argv);
+		++argv;
+		if (strcmp(*argv, "auto") == 0)
+		    glob->w = 0.0;	/* optimum, set once N is known */
+		else
+		    glob->w = atof(*argv);
 		break;
 	    case 'P':
 		--argc;
 		glob->PRINT = atoi(*++argv);
 		break;
+	    case 's':
+		--argc;
+		glob->Solver = *++argv;
+		if (strcmp(glob->Solver, "sor") != 0
+		    && strcmp(glob->Solver, "mixed") != 0
+		    && strcmp(glob->Solver, "mg") != 0
+		    && strcmp(glob->Solver, "fmg") != 0
+		    && strcmp(glob->Solver, "cg") != 0) {
+		    printf("%s: unknown solver %s, use sor, mixed, mg, fmg or cg\n",
+			   prog, glob->Solver);
+		    exit(1);
+		}
+		break;
+	    case 'p':
+		--argc;
+		glob->Precond = *++argv;
+		if (strcmp(glob->Precond, "jacobi") != 0
+		    && strcmp(glob->Precond, "ssor") != 0
+		    && strcmp(glob->Precond, "mg") != 0) {
+		    printf("%s: unknown preconditioner %s, use jacobi, ssor or mg\n",
+			   prog, glob->Precond);
+		    exit(1);
+		}
+		break;
+	    case 'S':
+		--argc;
+		glob->SPLIT = atoi(*++argv);
+		break;
+	    case 'c':
+		--argc;
+		++argv;
+		for (glob->CRIT = CRIT_L2; glob->CRIT > CRIT_NONE; glob->CRIT--)
+		    if (strcmp(*argv, crit_names[glob->CRIT]) == 0)
+			break;
+		if (glob->CRIT == CRIT_NONE) {
+		    printf("%s: unknown stop condition %s, "
+			   "use rowsum, delta, linf or l2\n", prog, *argv);
+		    exit(1);
+		}
+		break;
+	    case 'k':
+		--argc;
+		glob->CHECK = atoi(*++argv);
+		if (glob->CHECK < 1)
+		    glob->CHECK = 1;
+		break;
+	    case 'B':
+		--argc;
+		glob->BLOCK = atoi(*++argv);
+		break;
+	    case 't':
+		--argc;
+		glob->THREADS = atoi(*++argv);
+		if (glob->THREADS < 1)
+		    glob->THREADS = 1;
+		break;
 	    default:
 		printf("%s: ignored option: -%s\n", prog, *argv);
 		printf("HELP: try %s -u \n\n", prog);
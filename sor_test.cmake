@@ -0,0 +1,75 @@
+# Run sor with the arguments in REFERENCE and in ARGS and compare the
+# outputs, for the ctest smoke tests:
+#
+#   cmake -DSOR=path/to/sor -DREFERENCE="-n 33 -P 1" -DARGS="-n 33 -P 1 -S 1"
+#         [-DTOLERANCE=100] -P sor_test.cmake
+#
+# Without TOLERANCE the outputs have to be identical but for the Time:
+# line. With it only the printed matrices are compared, and every element
+# has to agree within TOLERANCE millionths, the last of the six decimals
+# sor prints.
+
+set(reference "sor ${REFERENCE}")
+set(variant "sor ${ARGS}")
+separate_arguments(REFERENCE)
+separate_arguments(ARGS)
+
+function(run_sor args result)
+	execute_process(COMMAND ${SOR} ${args} OUTPUT_VARIABLE output RESULT_VARIABLE status)
+	if(NOT status EQUAL 0)
+		string(REPLACE ";" " " args "${args}")
+		message(FATAL_ERROR "sor ${args} failed: ${status}\n${output}")
+	endif()
+	string(REGEX REPLACE "Time:[^\n]*" "" output "${output}")
+	set(${result} "${output}" PARENT_SCOPE)
+endfunction()
+
+# The elements of the printed matrices, in millionths.
+function(matrix_values output result)
+	string(REGEX MATCHALL "\n [-0-9][^\n]*" lines "${output}")
+	string(REGEX MATCHALL "-?[0-9]+\\.[0-9]+" numbers "${lines}")
+	set(values)
+	foreach(number IN LISTS numbers)
+		string(REPLACE "." "" number "${number}")
+		string(REGEX REPLACE "^(-?)0+([0-9])" "\\1\\2" number "${number}")
+		list(APPEND values ${number})
+	endforeach()
+	set(${result} "${values}" PARENT_SCOPE)
+endfunction()
+
+run_sor("${REFERENCE}" expected)
+run_sor("${ARGS}" actual)
+
+if(NOT DEFINED TOLERANCE)
+	if(NOT actual STREQUAL expected)
+		message(FATAL_ERROR "${variant} differs from ${reference}:\n${actual}")
+	endif()
+	return()
+endif()
+
+matrix_values("${expected}" expectedValues)
+matrix_values("${actual}" actualValues)
+list(LENGTH expectedValues count)
+list(LENGTH actualValues actualCount)
+if(count EQUAL 0 OR NOT count EQUAL actualCount)
+	message(FATAL_ERROR "${variant} printed ${actualCount} elements, ${reference} ${count}")
+endif()
+
+set(maxError 0)
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+	list(GET expectedValues ${i} x)
+	list(GET actualValues ${i} y)
+	math(EXPR error "${x} - ${y}")
+	if(error LESS 0)
+		math(EXPR error "-(${error})")
+	endif()
+	if(error GREATER maxError)
+		set(maxError ${error})
+	endif()
+endforeach()
+
+message(STATUS "largest difference ${maxError} millionths")
+if(maxError GREATER TOLERANCE)
+	message(FATAL_ERROR "${variant} differs from ${reference} by ${maxError} millionths, more than ${TOLERANCE}")
+endif()
@@ -0,0 +1,244 @@
+// Per-phase timing of the MPI programs.
+//
+// Every node adds up the time and the message bytes of each phase. The
+// report gathers them on the master, which prints how the time of each
+// phase is spread over the nodes: a max/mean far above 1 means the
+// other nodes wait for the slowest one in that phase.
+//
+// With a trace file each pass through a phase is also kept as an event,
+// relative to a common start after a barrier, and the master writes the
+// events of all nodes as complete ("X") events of the Chrome trace
+// format, one track per node.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "timing.h"
+
+// Events kept per node, later ones are counted but dropped.
+#define TIMING_MAX_EVENTS (1 << 20)
+
+struct timing_event
+{
+	double phase;
+	double start;
+	double end;
+	double bytes;
+};
+
+static int enabled = 0;
+static MPI_Comm timingComm;
+static int phaseCount;
+static const char *const *phaseNames;
+static double startTime;
+static double began[TIMING_MAX_PHASES];
+static double total[TIMING_MAX_PHASES];
+static long calls[TIMING_MAX_PHASES];
+static long bytes[TIMING_MAX_PHASES];
+
+static const char *traceName;
+static struct timing_event *events;
+static long eventCount, eventSpace, eventsDropped;
+
+void timing_init(MPI_Comm comm, int phases, const char *const *names, const char *traceFile)
+{
+	enabled = 1;
+	timingComm = comm;
+	phaseCount = (phases < TIMING_MAX_PHASES) ? phases : TIMING_MAX_PHASES;
+	phaseNames = names;
+	traceName = traceFile;
+	memset(total, 0, sizeof(total));
+	memset(calls, 0, sizeof(calls));
+	memset(bytes, 0, sizeof(bytes));
+	eventCount = eventSpace = eventsDropped = 0;
+
+	MPI_Barrier(comm);
+	startTime = MPI_Wtime();
+}
+
+void timing_begin(int phase)
+{
+	if (enabled)
+	{
+		began[phase] = MPI_Wtime();
+	}
+}
+
+void timing_end(int phase, long messageBytes)
+{
+	double now;
+
+	if (!enabled)
+	{
+		return;
+	}
+
+	now = MPI_Wtime();
+	total[phase] += now - began[phase];
+	calls[phase]++;
+	bytes[phase] += messageBytes;
+
+	if (traceName == NULL)
+	{
+		return;
+	}
+	if (eventCount == eventSpace)
+	{
+		struct timing_event *more = NULL;
+
+		if (eventSpace < TIMING_MAX_EVENTS)
+		{
+			eventSpace = eventSpace ? 2 * eventSpace : 4096;
+			more = realloc(events, sizeof(struct timing_event) * eventSpace);
+		}
+		if (more == NULL)
+		{
+			eventSpace = eventCount;
+			eventsDropped++;
+			return;
+		}
+		events = more;
+	}
+	events[eventCount].phase = phase;
+	events[eventCount].start = began[phase] - startTime;
+	events[eventCount].end = now - startTime;
+	events[eventCount].bytes = messageBytes;
+	eventCount++;
+}
+
+static void write_events(FILE *file, const struct timing_event *list, long count, int rank, int *first)
+{
+	long i;
+
+	for (i = 0; i < count; i++)
+	{
+		fprintf(file, "%s\n{\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+			"\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %.0f}}",
+			*first ? "" : ",", phaseNames[(int)list[i].phase], rank,
+			list[i].start * 1e6, (list[i].end - list[i].start) * 1e6, list[i].bytes);
+		*first = 0;
+	}
+}
+
+// The master writes its own events, then those of every other node in
+// turn, so it never holds more than one node's events.
+static void write_trace(int rank, int nodes)
+{
+	FILE *file = NULL;
+	long count, dropped;
+	int node, first = 1;
+
+	MPI_Reduce(&eventsDropped, &dropped, 1, MPI_LONG, MPI_SUM, 0, timingComm);
+	if (rank != 0)
+	{
+		MPI_Send(&eventCount, 1, MPI_LONG, 0, 0, timingComm);
+		MPI_Send(events, (int)(eventCount * 4), MPI_DOUBLE, 0, 0, timingComm);
+		return;
+	}
+
+	file = fopen(traceName, "w");
+	if (file == NULL)
+	{
+		printf("[ERROR] Could not write the trace to %s.\n", traceName);
+	}
+	else
+	{
+		fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+		for (node = 0; node < nodes; node++)
+		{
+			fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+				"\"args\": {\"name\": \"node %d\"}}", first ? "" : ",", node, node);
+			first = 0;
+		}
+		write_events(file, events, eventCount, 0, &first);
+	}
+
+	for (node = 1; node < nodes; node++)
+	{
+		struct timing_event *list;
+
+		MPI_Recv(&count, 1, MPI_LONG, node, 0, timingComm, MPI_STATUS_IGNORE);
+		list = malloc(sizeof(struct timing_event) * (count ? count : 1));
+		MPI_Recv(list, (int)(count * 4), MPI_DOUBLE, node, 0, timingComm, MPI_STATUS_IGNORE);
+		if (file != NULL)
+		{
+			write_events(file, list, count, node, &first);
+		}
+		free(list);
+	}
+
+	if (file != NULL)
+	{
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		printf("Trace written to %s", traceName);
+		if (dropped > 0)
+		{
+			printf(", %ld events dropped", dropped);
+		}
+		printf(".\n");
+	}
+}
+
+void timing_report(void)
+{
+	double *times = NULL;
+	long totalCalls[TIMING_MAX_PHASES], totalBytes[TIMING_MAX_PHASES];
+	int rank, nodes, phase, node;
+
+	if (!enabled)
+	{
+		return;
+	}
+
+	MPI_Comm_rank(timingComm, &rank);
+	MPI_Comm_size(timingComm, &nodes);
+	if (rank == 0)
+	{
+		times = malloc(sizeof(double) * nodes * phaseCount);
+	}
+	MPI_Gather(total, phaseCount, MPI_DOUBLE, times, phaseCount, MPI_DOUBLE, 0, timingComm);
+	MPI_Reduce(calls, totalCalls, phaseCount, MPI_LONG, MPI_SUM, 0, timingComm);
+	MPI_Reduce(bytes, totalBytes, phaseCount, MPI_LONG, MPI_SUM, 0, timingComm);
+
+	if (rank == 0)
+	{
+		printf("\n%-12s %10s %10s %10s %8s %8s %10s %14s\n", "Phase", "min (s)", "mean (s)", "max (s)",
+			"max/mean", "slowest", "calls", "bytes");
+		for (phase = 0; phase < phaseCount; phase++)
+		{
+			double min = times[phase], max = times[phase], sum = 0.0, mean;
+			int slowest = 0;
+
+			for (node = 0; node < nodes; node++)
+			{
+				double t = times[node * phaseCount + phase];
+
+				sum += t;
+				if (t < min)
+				{
+					min = t;
+				}
+				if (t > max)
+				{
+					max = t;
+					slowest = node;
+				}
+			}
+			mean = sum / nodes;
+			printf("%-12s %10.6f %10.6f %10.6f %8.2f %8d %10ld %14ld\n", phaseNames[phase], min, mean, max,
+				(mean > 0.0) ? max / mean : 1.0, slowest, totalCalls[phase], totalBytes[phase]);
+		}
+		printf("\n");
+		free(times);
+	}
+
+	if (traceName != NULL)
+	{
+		write_trace(rank, nodes);
+	}
+	free(events);
+	events = NULL;
+	enabled = 0;
+}
@@ -0,0 +1,26 @@
+// Per-phase timing of the MPI programs, used by matmul_mpi.c and laplace_mpi.c.
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <mpi.h>
+
+#define TIMING_MAX_PHASES 16
+
+// Start timing the phases names[0 .. phases - 1] on every node of comm,
+// collective. With traceFile set every begin/end pair is also recorded
+// and written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+// Until this is called the other functions do nothing.
+void timing_init(MPI_Comm comm, int phases, const char *const *names, const char *traceFile);
+
+// Mark the start and the end of one pass through a phase. bytes is the
+// size of the messages this node sends or receives in it.
+void timing_begin(int phase);
+void timing_end(int phase, long bytes);
+
+// Collective over the comm of timing_init(). The master prints, for every
+// phase, the minimum, mean and maximum time over the nodes, the slowest
+// node and the message bytes, then the trace is written.
+void timing_report(void);
+
+#endif